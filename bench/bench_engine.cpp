@@ -0,0 +1,124 @@
+#include "stats.hpp"
+#include "ttt.hpp"
+#include "session.hpp"
+
+#include <random>
+
+// Engine hot paths: the line check, move selection and whole games. Each
+// sample times a batch of BATCH operations; latencies are per operation.
+
+namespace {
+
+const int BATCH = 1024;
+const int SAMPLES = 2000;
+
+std::vector<Board> randomBoards(size_t count, int minMarks, std::mt19937 &rng) {
+    std::vector<Board> boards;
+    while (boards.size() < count) {
+        Board board = {0, 0};
+        int marks = minMarks + rng() % (9 - minMarks);
+        for (int m = 0; m < marks; ++m) {
+            int slot;
+            do {
+                slot = rng() % 9;
+            } while (!isEmpty(board, slot));
+            placeMark(board, slot, (m % 2) ? 'O' : 'X');
+        }
+        boards.push_back(board);
+    }
+    return boards;
+}
+
+template <typename Op>
+void run(const std::string &name, const char *unit, Op op) {
+    std::vector<double> perOp;
+    perOp.reserve(SAMPLES);
+    double totalNs = 0;
+    for (int s = 0; s < SAMPLES; ++s) {
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < BATCH; ++i) {
+            op(s * BATCH + i);
+        }
+        double ns = elapsedNs(start, Clock::now());
+        totalNs += ns;
+        perOp.push_back(ns / BATCH);
+    }
+    double ops = static_cast<double>(SAMPLES) * BATCH;
+    printRow(name, formatRate(ops / (totalNs / 1e9), unit), summarize(perOp));
+}
+
+volatile long sink;
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(20240601);
+    std::vector<Board> boards = randomBoards(1 << 16, 0, rng);
+    size_t mask = boards.size() - 1;
+
+    printHeader("ttt engine");
+
+    run("checkWin", "op", [&](int i) { sink = sink + checkWin(boards[i & mask], 'X'); });
+
+    // A block of boards per operation, on every implementation this CPU has
+    std::vector<BoardBatch> blocks(boards.size() / BATCH_BOARDS);
+    for (size_t i = 0; i < boards.size(); ++i) {
+        blocks[i / BATCH_BOARDS].x[i % BATCH_BOARDS] = boards[i].x;
+        blocks[i / BATCH_BOARDS].o[i % BATCH_BOARDS] = boards[i].o;
+    }
+    size_t blockMask = blocks.size() - 1;
+    const char *backends[] = {"avx2", "sse2", "scalar"};
+    for (const char *name : backends) {
+        if (!useWinBatchBackend(name)) continue;
+        run(std::string("checkWinBatch (") + name + ")", "block", [&](int i) {
+            uint32_t xWins, oWins;
+            checkWinBatch(&blocks[i & blockMask], 1, &xWins, &oWins);
+            sink = sink + xWins + oWins;
+        });
+    }
+
+    StrategyTable moves;
+    compileStrategy("519372846", moves);
+    run("pickMove (strategy table)", "op", [&](int i) {
+        const Board &board = boards[i & mask];
+        if (!isFull(board)) sink = sink + pickMove(moves, board);
+    });
+
+    const PerfectTable &perfect = sharedPerfectTable();
+    run("perfectMove", "op", [&](int i) {
+        const Board &board = boards[i & mask];
+        if (!isFull(board)) sink = sink + perfectMove(perfect, board);
+    });
+
+    // Whole games against a seeded random opponent
+    std::vector<uint32_t> choices(1 << 16);
+    for (uint32_t &c : choices) {
+        c = rng();
+    }
+    const char *strategies[] = {"519372846", "--perfect"};
+    for (const char *strategy : strategies) {
+        GameSession session;
+        run(std::string("game (") + (strategy[0] == '-' ? "perfect" : "strategy, incl. compile") + ")", "game", [&](int i) {
+            if (strategy[0] == '-') {
+                session.startPerfect();
+            } else {
+                session.start(strategy);
+            }
+            uint32_t choice = choices[i & (choices.size() - 1)];
+            while (true) {
+                session.programMove();
+                if (session.state() != GAME_IN_PROGRESS) break;
+                uint16_t empty = emptyCells(session.board());
+                int skip = choice % __builtin_popcount(empty);
+                choice /= 3;
+                while (skip--) {
+                    empty &= empty - 1;
+                }
+                session.playerMove(__builtin_ctz(empty));
+                if (session.state() != GAME_IN_PROGRESS) break;
+            }
+            sink = sink + session.state();
+        });
+    }
+    return 0;
+}
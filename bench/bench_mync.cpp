@@ -0,0 +1,416 @@
+#include "stats.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// Relays "-e cat" through mync on loopback and measures per-message round
+// trips (client -> mync -> cat -> sink) and bulk bytes/sec for each socket
+// family mync speaks. Then measures connect-to-first-byte for --serve with
+// and without a pool of started programs, and with the game played inside
+// mync (builtin:ttt), which also gets rows for many games held open at
+// once along with mync's resident memory, on one event loop and on one per
+// CPU.
+//
+// usage: bench_mync [inet-mync] [unix-mync] [base-port]
+
+namespace {
+
+const int LATENCY_MESSAGES = 10000;
+const size_t MESSAGE_SIZE = 64;
+const size_t STREAM_TOTAL = 64 << 20;
+const size_t STREAM_CHUNK = 64 << 10;
+const int DGRAM_COUNT = 50000;
+const size_t DGRAM_SIZE = 1024;
+const int DGRAM_WINDOW = 32;
+const int SERVE_CONNECTIONS = 500;
+const int SERVE_GAP_US = 5000; // Lets a pool refill between clients
+const int HELD_GAMES = 10000;
+
+struct Endpoint {
+    sockaddr_storage addr;
+    socklen_t len;
+};
+
+struct Transport {
+    const char *name;
+    int family;
+    int type;
+    const char *serverPrefix; // mync -i
+    const char *clientPrefix; // mync -o
+};
+
+const Transport TRANSPORTS[] = {
+    {"tcp", AF_INET, SOCK_STREAM, "TCPS", "TCPC"},
+    {"udp", AF_INET, SOCK_DGRAM, "UDPS", "UDPC"},
+    {"unix-stream", AF_UNIX, SOCK_STREAM, "UDSSS", "UDSCS"},
+    {"unix-dgram", AF_UNIX, SOCK_DGRAM, "UDSSD", "UDSCD"},
+};
+
+void fail(const std::string &what) {
+    fprintf(stderr, "bench_mync: %s: %s\n", what.c_str(), strerror(errno));
+    exit(1);
+}
+
+Endpoint inetEndpoint(int port) {
+    Endpoint ep;
+    memset(&ep, 0, sizeof(ep));
+    sockaddr_in *in = reinterpret_cast<sockaddr_in *>(&ep.addr);
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    in->sin_port = htons(port);
+    ep.len = sizeof(sockaddr_in);
+    return ep;
+}
+
+Endpoint unixEndpoint(const std::string &path) {
+    Endpoint ep;
+    memset(&ep, 0, sizeof(ep));
+    sockaddr_un *un = reinterpret_cast<sockaddr_un *>(&ep.addr);
+    un->sun_family = AF_UNIX;
+    strncpy(un->sun_path, path.c_str(), sizeof(un->sun_path) - 1);
+    ep.len = sizeof(sockaddr_un);
+    return ep;
+}
+
+void setTimeout(int fd, int ms) {
+    timeval tv = {ms / 1000, (ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+bool readExact(int fd, char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t got = read(fd, buf, n);
+        if (got <= 0) return false;
+        buf += got;
+        n -= got;
+    }
+    return true;
+}
+
+bool writeAll(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t put = write(fd, buf, n);
+        if (put < 0 && errno == EINTR) continue;
+        if (put <= 0) return false;
+        buf += put;
+        n -= put;
+    }
+    return true;
+}
+
+pid_t spawnMync(const std::string &mync, const std::vector<std::string> &args) {
+    pid_t pid = fork();
+    if (pid < 0) fail("fork");
+    if (pid == 0) {
+        // Own process group, so the relay and its cat can be stopped together
+        setpgid(0, 0);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>(mync.c_str()));
+        for (const std::string &arg : args) {
+            argv.push_back(const_cast<char *>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(mync.c_str(), argv.data());
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    return pid;
+}
+
+void stopMync(pid_t pid) {
+    kill(-pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+// Connects (stream) or associates (datagram) with mync's input, retrying
+// until mync has bound it
+int connectClient(const Transport &t, const Endpoint &ep) {
+    for (int attempt = 0; attempt < 5000; ++attempt) {
+        int fd = socket(t.family, t.type, 0);
+        if (fd < 0) fail("socket");
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&ep.addr), ep.len) == 0) return fd;
+        close(fd);
+        usleep(1000);
+    }
+    fail("connect to mync");
+    return -1;
+}
+
+// Datagram inputs give no bind signal, so probe until one comes through,
+// then drain any duplicates
+void awaitDatagramPath(int client, int sink) {
+    char probe[MESSAGE_SIZE] = {};
+    char buf[DGRAM_SIZE];
+    for (int attempt = 0; attempt < 500; ++attempt) {
+        send(client, probe, sizeof(probe), 0);
+        pollfd pfd = {sink, POLLIN, 0};
+        if (poll(&pfd, 1, 10) > 0) {
+            usleep(50000);
+            while (recv(sink, buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+            }
+            return;
+        }
+    }
+    fail("no datagram reached the sink");
+}
+
+void benchLatency(const Transport &t, int client, int sink) {
+    char out[MESSAGE_SIZE], in[DGRAM_SIZE];
+    memset(out, 'm', sizeof(out));
+    std::vector<double> rtt;
+    rtt.reserve(LATENCY_MESSAGES);
+    int lost = 0;
+    Clock::time_point begin = Clock::now();
+    for (int i = 0; i < LATENCY_MESSAGES; ++i) {
+        Clock::time_point start = Clock::now();
+        if (!writeAll(client, out, sizeof(out))) fail("write");
+        bool ok = (t.type == SOCK_STREAM) ? readExact(sink, in, sizeof(out)) : recv(sink, in, sizeof(in), 0) > 0;
+        if (!ok) {
+            if (t.type == SOCK_STREAM) fail("read");
+            ++lost;
+            continue;
+        }
+        rtt.push_back(elapsedNs(start, Clock::now()));
+    }
+    double seconds = elapsedNs(begin, Clock::now()) / 1e9;
+    std::string name = std::string(t.name) + " message";
+    if (lost) name += " (" + std::to_string(lost) + " lost)";
+    printRow(name, formatRate(rtt.size() / seconds, "msg"), summarize(rtt));
+}
+
+void benchStream(const Transport &t, int client, int sink) {
+    std::thread writer([client]() {
+        std::vector<char> chunk(STREAM_CHUNK, 's');
+        for (size_t sent = 0; sent < STREAM_TOTAL; sent += STREAM_CHUNK) {
+            if (!writeAll(client, chunk.data(), chunk.size())) fail("write");
+        }
+    });
+    std::vector<char> buf(STREAM_CHUNK);
+    std::vector<double> perChunk;
+    Clock::time_point begin = Clock::now(), last = begin;
+    for (size_t got = 0; got < STREAM_TOTAL; got += STREAM_CHUNK) {
+        if (!readExact(sink, buf.data(), buf.size())) fail("read");
+        Clock::time_point now = Clock::now();
+        perChunk.push_back(elapsedNs(last, now));
+        last = now;
+    }
+    double seconds = elapsedNs(begin, last) / 1e9;
+    writer.join();
+    printRow(std::string(t.name) + " bulk (64K chunks)", formatRate(STREAM_TOTAL / seconds, "B"), summarize(perChunk));
+}
+
+void benchDatagrams(const Transport &t, int client, int sink) {
+    std::vector<char> out(DGRAM_SIZE, 'd'), in(DGRAM_SIZE);
+    std::vector<double> gaps;
+    int sent = 0, received = 0, lost = 0;
+    Clock::time_point begin = Clock::now(), last = begin;
+    while (sent < DGRAM_COUNT || received + lost < sent) {
+        // Keep a bounded window in flight, so drops reflect the relay, not the
+        // sender; Unix datagram peers push back instead of dropping
+        while (sent < DGRAM_COUNT && sent - received - lost < DGRAM_WINDOW) {
+            if (send(client, out.data(), out.size(), MSG_DONTWAIT) < 0 && errno == EAGAIN) break;
+            ++sent;
+        }
+        if (recv(sink, in.data(), in.size(), 0) > 0) {
+            Clock::time_point now = Clock::now();
+            gaps.push_back(elapsedNs(last, now));
+            last = now;
+            ++received;
+        } else {
+            lost = sent - received; // Timed out: the window is gone
+        }
+    }
+    double seconds = elapsedNs(begin, last) / 1e9;
+    std::string name = std::string(t.name) + " bulk (1K dgrams)";
+    if (lost) name += " (" + std::to_string(lost) + " lost)";
+    printRow(name, formatRate(received * DGRAM_SIZE / seconds, "B"), summarize(gaps));
+}
+
+void benchTransport(const Transport &t, const std::string &mync, int port, const std::string &dir) {
+    Endpoint input, output;
+    std::string inputSpec, outputSpec;
+    if (t.family == AF_INET) {
+        input = inetEndpoint(port);
+        output = inetEndpoint(port + 1);
+        inputSpec = t.serverPrefix + std::to_string(port);
+        outputSpec = std::string(t.clientPrefix) + "127.0.0.1," + std::to_string(port + 1);
+    } else {
+        std::string in = dir + "/in.sock", out = dir + "/out.sock";
+        unlink(out.c_str());
+        input = unixEndpoint(in);
+        output = unixEndpoint(out);
+        inputSpec = t.serverPrefix + in;
+        outputSpec = t.clientPrefix + out;
+    }
+
+    int sink = socket(t.family, t.type, 0);
+    int one = 1;
+    setsockopt(sink, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (sink < 0 || bind(sink, reinterpret_cast<sockaddr *>(&output.addr), output.len) < 0) fail("bind sink");
+    if (t.type == SOCK_STREAM && listen(sink, 1) < 0) fail("listen sink");
+
+    pid_t pid = spawnMync(mync, {"-e", "cat", "-i", inputSpec, "-o", outputSpec});
+    int client = connectClient(t, input);
+    if (t.type == SOCK_STREAM) {
+        setTimeout(sink, 5000);
+        int conn = accept4(sink, nullptr, nullptr, SOCK_CLOEXEC);
+        if (conn < 0) fail("accept from mync");
+        close(sink);
+        sink = conn;
+    }
+    setTimeout(sink, t.type == SOCK_STREAM ? 5000 : 100);
+    if (t.type == SOCK_DGRAM) {
+        awaitDatagramPath(client, sink);
+    }
+
+    benchLatency(t, client, sink);
+    if (t.type == SOCK_STREAM) {
+        benchStream(t, client, sink);
+    } else {
+        benchDatagrams(t, client, sink);
+    }
+
+    close(client);
+    close(sink);
+    stopMync(pid);
+    if (t.family == AF_UNIX) {
+        unlink((dir + "/out.sock").c_str());
+        unlink((dir + "/in.sock").c_str());
+    }
+}
+
+// Each connection is answered by a fresh ttt (the one built next to mync)
+// printing its opening move; the time to that first byte includes process
+// creation unless a pool started the game earlier, or mync plays it itself
+void benchServe(const std::string &mync, int port, int pool, bool builtin) {
+    std::string ttt = builtin ? "builtin:ttt" : mync.substr(0, mync.rfind('/') + 1) + "ttt";
+    std::vector<std::string> args = {"-e", ttt + " 123456789", "-b", "TCPS" + std::to_string(port), "--serve"};
+    if (pool > 0) {
+        args.push_back("--pool");
+        args.push_back(std::to_string(pool));
+    }
+    pid_t pid = spawnMync(mync, args);
+    Endpoint ep = inetEndpoint(port);
+    close(connectClient(TRANSPORTS[0], ep));
+
+    std::vector<double> firstByte;
+    Clock::time_point begin = Clock::now();
+    for (int i = 0; i < SERVE_CONNECTIONS; ++i) {
+        Clock::time_point start = Clock::now();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&ep.addr), ep.len) < 0) fail("connect to mync");
+        setTimeout(fd, 5000);
+        char byte;
+        if (read(fd, &byte, 1) != 1) fail("read");
+        firstByte.push_back(elapsedNs(start, Clock::now()));
+        close(fd);
+        usleep(SERVE_GAP_US);
+    }
+    double seconds = elapsedNs(begin, Clock::now()) / 1e9;
+    stopMync(pid);
+    std::string name = builtin ? "serve, builtin:ttt"
+                       : pool > 0 ? "serve, pool of " + std::to_string(pool)
+                                  : "serve, fork per client";
+    printRow(name, formatRate(SERVE_CONNECTIONS / seconds, "conn"), summarize(firstByte));
+}
+
+// Resident memory of a process in kB, from /proc
+long residentKb(pid_t pid) {
+    std::string path = "/proc/" + std::to_string(pid) + "/status";
+    FILE *status = fopen(path.c_str(), "r");
+    if (!status) return -1;
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), status)) {
+        if (sscanf(line, "VmRSS: %ld", &kb) == 1) break;
+    }
+    fclose(status);
+    return kb;
+}
+
+// Opens HELD_GAMES builtin games and keeps them all open, each having read
+// the program's opening; the rate is of games started, the latency that
+// of each opening, and mync's memory is taken with every game in progress
+// and given per game.
+// With threads, mync runs an event loop per CPU.
+void benchHeld(const std::string &mync, int port, bool threads) {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit); // Inherited by mync
+    }
+    std::vector<std::string> args = {"-e", "builtin:ttt --machine 123456789", "-b", "TCPS" + std::to_string(port),
+                                     "--serve"};
+    if (threads) args.push_back("--threads");
+    pid_t pid = spawnMync(mync, args);
+    Endpoint ep = inetEndpoint(port);
+    close(connectClient(TRANSPORTS[0], ep));
+    usleep(100000);
+    long idleKb = residentKb(pid);
+
+    std::vector<int> games;
+    std::vector<double> opening;
+    Clock::time_point begin = Clock::now();
+    for (int i = 0; i < HELD_GAMES; ++i) {
+        Clock::time_point start = Clock::now();
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) break; // Out of descriptors: report what was reached
+        if (connect(fd, reinterpret_cast<sockaddr *>(&ep.addr), ep.len) < 0) fail("connect to mync");
+        setTimeout(fd, 5000);
+        char move[2];
+        if (!readExact(fd, move, sizeof(move))) fail("read");
+        opening.push_back(elapsedNs(start, Clock::now()));
+        games.push_back(fd);
+    }
+    double seconds = elapsedNs(begin, Clock::now()) / 1e9;
+    long heldKb = residentKb(pid);
+    for (int fd : games) {
+        close(fd);
+    }
+    stopMync(pid);
+    char name[96];
+    long perGame = games.empty() ? 0 : (heldKb - idleKb) * 1024 / static_cast<long>(games.size());
+    snprintf(name, sizeof(name), "builtin%s, %zu held, %ld B each", threads ? " --threads" : "", games.size(),
+             perGame);
+    printRow(name, formatRate(games.size() / seconds, "game"), summarize(opening));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string inetMync = argc > 1 ? argv[1] : "../qst4/mync";
+    std::string unixMync = argc > 2 ? argv[2] : "../qst6/mync";
+    int port = argc > 3 ? atoi(argv[3]) : 31000;
+
+    signal(SIGPIPE, SIG_IGN);
+    char dir[] = "/tmp/bench_mync.XXXXXX";
+    if (!mkdtemp(dir)) fail("mkdtemp");
+
+    printHeader("mync -e cat relay, loopback");
+    for (const Transport &t : TRANSPORTS) {
+        benchTransport(t, t.family == AF_INET ? inetMync : unixMync, port, dir);
+        port += 2;
+    }
+    rmdir(dir);
+
+    printHeader("mync --serve, connect to first byte (5 ms apart)");
+    benchServe(inetMync, port, 0, false);
+    benchServe(inetMync, port + 1, 4, false);
+    benchServe(inetMync, port + 2, 0, true);
+    benchHeld(inetMync, port + 3, false);
+    benchHeld(inetMync, port + 4, true);
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "stats.hpp"
+
+#include "relay.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// Pushes a bulk stream through runRelay in process and compares the copy
+// loop against the zero-copy paths (splice between sockets and pipes,
+// sendfile out of a regular file).
+//
+// usage: bench_relay [megabytes] [runs]
+
+namespace {
+
+const size_t CHUNK = 256 << 10;
+
+void fail(const std::string &what) {
+    fprintf(stderr, "bench_relay: %s: %s\n", what.c_str(), strerror(errno));
+    exit(1);
+}
+
+void produce(int fd, size_t total) {
+    std::vector<char> chunk(CHUNK, 'x');
+    size_t sent = 0;
+    while (sent < total) {
+        ssize_t n = write(fd, chunk.data(), std::min(CHUNK, total - sent));
+        if (n <= 0) fail("write");
+        sent += n;
+    }
+    close(fd);
+}
+
+void consume(int fd, size_t *received) {
+    std::vector<char> chunk(CHUNK);
+    ssize_t n;
+    while ((n = read(fd, chunk.data(), chunk.size())) > 0) {
+        *received += n;
+    }
+    close(fd);
+}
+
+// Source and sink for one run; the relay sits between them
+struct Path {
+    const char *name;
+    bool fileSource;
+    bool sockets;
+};
+
+const Path PATHS[] = {
+    {"socket -> socket", false, true},
+    {"pipe -> pipe", false, false},
+    {"file -> socket", true, true},
+};
+
+void makePair(bool sockets, int fds[2]) {
+    if (sockets) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) fail("socketpair");
+    } else {
+        if (pipe(fds) < 0) fail("pipe");
+    }
+}
+
+int makeFile(size_t total) {
+    char name[] = "/tmp/bench_relay_XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0) fail("mkstemp");
+    unlink(name);
+    std::vector<char> chunk(CHUNK, 'x');
+    for (size_t written = 0; written < total; written += CHUNK) {
+        if (write(fd, chunk.data(), std::min(CHUNK, total - written)) <= 0) fail("write");
+    }
+    return fd;
+}
+
+// Returns the wall time of one relay of total bytes
+double relayOnce(const Path &path, int file, size_t total, bool zeroCopy) {
+    int in[2] = {-1, -1}, out[2];
+    makePair(path.sockets, out);
+    RelayEndpoint a = {-1, -1, path.sockets};
+    RelayEndpoint b = {-1, out[1], path.sockets};
+    if (path.sockets) b.in = out[1];
+    if (path.fileSource) {
+        lseek(file, 0, SEEK_SET);
+        a.in = dup(file);
+        a.socket = false;
+    } else {
+        makePair(path.sockets, in);
+        a.in = in[0];
+        if (path.sockets) a.out = in[0];
+    }
+
+    size_t received = 0;
+    Clock::time_point start = Clock::now();
+    std::thread producer;
+    if (!path.fileSource) producer = std::thread(produce, in[1], total);
+    std::thread consumer(consume, out[0], &received);
+    if (runRelay(a, b, zeroCopy) < 0) fail("runRelay");
+    // The sink only sees end of stream once the relay's side is closed
+    close(out[1]);
+    consumer.join();
+    if (producer.joinable()) producer.join();
+    Clock::time_point end = Clock::now();
+    close(a.in);
+
+    if (received != total) {
+        fprintf(stderr, "bench_relay: %s relayed %zu of %zu bytes\n", path.name, received, total);
+        exit(1);
+    }
+    return elapsedNs(start, end);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN); // As in mync, which runRelay expects
+    size_t megabytes = argc > 1 ? strtoul(argv[1], nullptr, 10) : 256;
+    int runs = argc > 2 ? atoi(argv[2]) : 5;
+    if (megabytes == 0 || runs <= 0) {
+        fprintf(stderr, "usage: bench_relay [megabytes] [runs]\n");
+        return 1;
+    }
+    size_t total = megabytes << 20;
+    int file = makeFile(total);
+
+    printHeader("relay throughput (per-run latency)");
+    for (const Path &path : PATHS) {
+        for (int zeroCopy = 0; zeroCopy <= 1; ++zeroCopy) {
+            std::vector<double> samples;
+            double totalNs = 0;
+            for (int i = 0; i < runs; ++i) {
+                samples.push_back(relayOnce(path, file, total, zeroCopy));
+                totalNs += samples.back();
+            }
+            std::string name = std::string(path.name) + (zeroCopy ? " zero-copy" : " copy");
+            printRow(name, formatRate(total * runs / (totalNs / 1e9), "B"), summarize(samples));
+        }
+    }
+    close(file);
+    return 0;
+}
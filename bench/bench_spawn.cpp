@@ -0,0 +1,95 @@
+#include "stats.hpp"
+
+#include "command.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Spawn-to-exit latency of a -e command the way mync used to start it
+// (fork, then /bin/sh -c) against the direct paths (fork + execvp, and
+// posix_spawn). Repeated with a larger parent, since fork copies page
+// tables and posix_spawn does not.
+//
+// usage: bench_spawn [command] [runs]
+
+namespace {
+
+const size_t LARGE_PARENT = 256 << 20;
+
+void fail(const char *what) {
+    perror(what);
+    exit(1);
+}
+
+void waitFor(pid_t pid) {
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid) fail("spawn");
+}
+
+pid_t forkShell(const std::string &line, const Command &) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", line.c_str(), nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+pid_t forkDirect(const std::string &, const Command &command) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execCommand(command);
+        _exit(127);
+    }
+    return pid;
+}
+
+pid_t spawnDirect(const std::string &, const Command &command) {
+    return spawnCommand(command);
+}
+
+struct Method {
+    const char *name;
+    pid_t (*start)(const std::string &, const Command &);
+};
+
+const Method METHODS[] = {
+    {"fork + sh -c", forkShell},
+    {"fork + execvp", forkDirect},
+    {"posix_spawn", spawnDirect},
+};
+
+void benchMethods(const std::string &line, int runs, const char *parent) {
+    Command command = parseCommand(line);
+    for (const Method &method : METHODS) {
+        std::vector<double> samples;
+        Clock::time_point begin = Clock::now();
+        for (int i = 0; i < runs; ++i) {
+            Clock::time_point start = Clock::now();
+            waitFor(method.start(line, command));
+            samples.push_back(elapsedNs(start, Clock::now()));
+        }
+        double seconds = elapsedNs(begin, Clock::now()) / 1e9;
+        printRow(std::string(method.name) + ", " + parent, formatRate(runs / seconds, "proc"), summarize(samples));
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string line = argc > 1 ? argv[1] : "/bin/true";
+    int runs = argc > 2 ? atoi(argv[2]) : 1000;
+    if (runs <= 0 || parseCommand(line).shell) {
+        fprintf(stderr, "usage: bench_spawn [command without shell syntax] [runs]\n");
+        return 1;
+    }
+
+    printHeader(("spawn and wait for \"" + line + "\"").c_str());
+    benchMethods(line, runs, "small parent");
+    std::vector<char> ballast(LARGE_PARENT);
+    memset(ballast.data(), 1, ballast.size()); // Fault every page in
+    benchMethods(line, runs, "256M parent");
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "stats.hpp"
+
+#include "event_loop.hpp"
+#include "relay.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// Many loopback TCP connections relayed on one loop by runRelays, once on
+// epoll and once on io_uring. Every connection carries small request and
+// echo round trips, all of them at once, as a busy --serve relay would;
+// the rows give round trips per second and the latency of each.
+//
+// usage: bench_uring [rounds] [connections...]
+
+namespace {
+
+const size_t MESSAGE = 64;
+const int DEFAULT_COUNTS[] = {16, 256, 1024};
+
+void fail(const char *what) {
+    fprintf(stderr, "bench_uring: %s: %s\n", what, strerror(errno));
+    exit(1);
+}
+
+// Both ends of one loopback TCP connection through listener
+void connectPair(int listener, const sockaddr_in &address, int fds[2]) {
+    fds[0] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fds[0] < 0) fail("socket");
+    if (connect(fds[0], reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0) fail("connect");
+    fds[1] = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fds[1] < 0) fail("accept");
+    int one = 1;
+    setsockopt(fds[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fds[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// The client and echo ends of every connection; the relay sits between
+// client[i] and echo[i]
+struct Connections {
+    std::vector<int> client;
+    std::vector<int> echo;
+    std::vector<RelayPair> relayed;
+};
+
+Connections open(int count) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 ||
+        listen(listener, 128) < 0 || getsockname(listener, reinterpret_cast<sockaddr *>(&address), &length) < 0) {
+        fail("listen");
+    }
+    Connections connections;
+    for (int i = 0; i < count; ++i) {
+        int front[2], back[2];
+        connectPair(listener, address, front);
+        connectPair(listener, address, back);
+        connections.client.push_back(front[0]);
+        connections.echo.push_back(back[1]);
+        RelayPair pair = {{front[1], front[1], true}, {back[0], back[0], true}};
+        connections.relayed.push_back(pair);
+    }
+    close(listener);
+    return connections;
+}
+
+// Runs rounds round trips on every connection at once, answering at the
+// echo ends, and closes the client and echo ends when done
+void drive(const Connections &connections, int rounds, std::vector<double> *latencies, double *elapsed) {
+    int count = static_cast<int>(connections.client.size());
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) fail("epoll_create1");
+    // Client ends are 0..count-1 in the event data, echo ends count..2count-1
+    for (int i = 0; i < 2 * count; ++i) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        int fd = i < count ? connections.client[i] : connections.echo[i - count];
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) fail("epoll_ctl");
+    }
+
+    char message[MESSAGE];
+    memset(message, 'x', sizeof(message));
+    std::vector<Clock::time_point> sent(count);
+    std::vector<size_t> received(count, 0);
+    std::vector<int> left(count, rounds);
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < count; ++i) {
+        sent[i] = Clock::now();
+        if (write(connections.client[i], message, MESSAGE) != static_cast<ssize_t>(MESSAGE)) fail("write");
+    }
+
+    int finished = 0;
+    char buffer[4096];
+    epoll_event events[256];
+    while (finished < count) {
+        int n = epoll_wait(epfd, events, 256, -1);
+        if (n < 0 && errno != EINTR) fail("epoll_wait");
+        for (int e = 0; e < n; ++e) {
+            int i = static_cast<int>(events[e].data.u32);
+            if (i >= count) {
+                ssize_t got = read(connections.echo[i - count], buffer, sizeof(buffer));
+                if (got <= 0) fail("echo read");
+                if (write(connections.echo[i - count], buffer, got) != got) fail("echo write");
+                continue;
+            }
+            ssize_t got = read(connections.client[i], buffer, sizeof(buffer));
+            if (got <= 0) fail("client read");
+            received[i] += got;
+            if (received[i] < MESSAGE) continue;
+            received[i] -= MESSAGE;
+            Clock::time_point now = Clock::now();
+            latencies->push_back(elapsedNs(sent[i], now));
+            if (--left[i] == 0) {
+                ++finished;
+                continue;
+            }
+            sent[i] = now;
+            if (write(connections.client[i], message, MESSAGE) != static_cast<ssize_t>(MESSAGE)) fail("write");
+        }
+    }
+    *elapsed = elapsedNs(start, Clock::now());
+    close(epfd);
+    for (int i = 0; i < count; ++i) {
+        close(connections.client[i]);
+        close(connections.echo[i]);
+    }
+}
+
+void runOnce(IoBackend backend, const char *name, int count, int rounds) {
+    Connections connections = open(count);
+    std::vector<double> latencies;
+    latencies.reserve(static_cast<size_t>(count) * rounds);
+    double elapsed = 0;
+
+    setIoBackend(backend);
+    std::thread driver(drive, std::cref(connections), rounds, &latencies, &elapsed);
+    // Game-sized traffic, so the copy path as --serve relays it
+    if (runRelays(connections.relayed, false) < 0) fail("runRelays");
+    driver.join();
+    for (const RelayPair &pair : connections.relayed) {
+        close(pair.a.in);
+        close(pair.b.in);
+    }
+
+    std::string label = std::string(name) + ", " + std::to_string(count) + " conns";
+    printRow(label, formatRate(latencies.size() / (elapsed / 1e9), "rt"), summarize(latencies));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    signal(SIGPIPE, SIG_IGN); // As in mync, which runRelay expects
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    std::vector<int> counts;
+    for (int i = 2; i < argc; ++i) {
+        counts.push_back(atoi(argv[i]));
+    }
+    if (counts.empty()) counts.assign(DEFAULT_COUNTS, DEFAULT_COUNTS + sizeof(DEFAULT_COUNTS) / sizeof(int));
+    if (rounds <= 0 || *std::min_element(counts.begin(), counts.end()) <= 0) {
+        fprintf(stderr, "usage: bench_uring [rounds] [connections...]\n");
+        return 1;
+    }
+    // Four descriptors a connection
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    printHeader("relayed round trips, epoll vs io_uring (per-round-trip latency)");
+    for (int count : counts) {
+        runOnce(IO_BACKEND_EPOLL, "epoll", count, rounds);
+        runOnce(IO_BACKEND_URING, "io_uring", count, rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Shared reporting for the benchmark programs: one row per benchmark with a
+// throughput figure and p50/p99/p999 of the per-sample latency.
+
+typedef std::chrono::steady_clock Clock;
+
+inline double elapsedNs(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+struct Summary {
+    double p50;
+    double p99;
+    double p999;
+};
+
+inline Summary summarize(std::vector<double> samples) {
+    Summary summary = {0, 0, 0};
+    if (samples.empty()) return summary;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double q) {
+        size_t i = static_cast<size_t>(q * (samples.size() - 1) + 0.5);
+        return samples[i];
+    };
+    summary.p50 = at(0.50);
+    summary.p99 = at(0.99);
+    summary.p999 = at(0.999);
+    return summary;
+}
+
+// Scales a nanosecond figure to the most readable unit
+inline std::string formatNs(double ns) {
+    char text[32];
+    if (ns < 1e3) {
+        snprintf(text, sizeof(text), "%.1f ns", ns);
+    } else if (ns < 1e6) {
+        snprintf(text, sizeof(text), "%.2f us", ns / 1e3);
+    } else {
+        snprintf(text, sizeof(text), "%.2f ms", ns / 1e6);
+    }
+    return text;
+}
+
+inline std::string formatRate(double perSecond, const char *unit) {
+    char text[48];
+    if (perSecond >= 1e9) {
+        snprintf(text, sizeof(text), "%.2f G%s/s", perSecond / 1e9, unit);
+    } else if (perSecond >= 1e6) {
+        snprintf(text, sizeof(text), "%.2f M%s/s", perSecond / 1e6, unit);
+    } else if (perSecond >= 1e3) {
+        snprintf(text, sizeof(text), "%.2f K%s/s", perSecond / 1e3, unit);
+    } else {
+        snprintf(text, sizeof(text), "%.2f %s/s", perSecond, unit);
+    }
+    return text;
+}
+
+inline void printHeader(const char *title) {
+    printf("\n%s\n", title);
+    printf("%-28s %18s %12s %12s %12s\n", "benchmark", "throughput", "p50", "p99", "p999");
+}
+
+inline void printRow(const std::string &name, const std::string &throughput, const Summary &latency) {
+    printf("%-28s %18s %12s %12s %12s\n", name.c_str(), throughput.c_str(), formatNs(latency.p50).c_str(),
+           formatNs(latency.p99).c_str(), formatNs(latency.p999).c_str());
+    fflush(stdout);
+}
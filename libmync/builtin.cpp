@@ -0,0 +1,342 @@
+#include "builtin.hpp"
+#include "event_loop.hpp"
+#include "runtime.hpp"
+#include "slab.hpp"
+#include "trace.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <memory>
+#include <new>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const size_t READ_SIZE = 4096;
+
+// Shared by every connection on the thread's loop: input is handed to the
+// session as soon as it is read
+thread_local char readBuffer[READ_SIZE];
+
+class BuiltinConnection;
+
+// The loop a connection runs on, told once the connection has ended and
+// left it
+class ConnectionOwner {
+public:
+    virtual ~ConnectionOwner() {}
+    virtual EventLoop &loop() = 0;
+    virtual void ended(BuiltinConnection &connection) = 0;
+};
+
+// What a connection needs only with a timeout set or while traced, in a
+// slab record of its own so that other connections go without
+class ConnectionExtras : public TimerHandler, public SlabAllocated {
+public:
+    ConnectionExtras(BuiltinConnection &connection, TimerWheel &wheel, EventLoop &loop,
+                     const SessionTimeouts &limits, ConnectionTrace *trace)
+        : timers(wheel, loop, limits, this), trace(trace), connection_(connection) {}
+
+    void onTimer(Timer &timer) override;
+
+    SessionTimers timers;
+    ConnectionTrace *trace; // Null unless traced
+
+private:
+    BuiltinConnection &connection_;
+};
+
+// One session on a loop, in a slab record that the session itself is built
+// at the end of. Input is only read once everything the session has said
+// is written, so a client that sends without reading fills its own socket
+// buffers rather than ours, and a connection holds a buffer only while a
+// reply is on its way.
+class BuiltinConnection : public EventHandler {
+public:
+    // Makes a connection and its session, or returns nullptr (errno set)
+    static BuiltinConnection *make(TimerWheel &wheel, const SessionTimeouts &limits, int in, int out,
+                                   const SessionFactory &newSession, ConnectionOwner &owner,
+                                   ConnectionTrace *trace) {
+        void *record = slabAllocate(SESSION_OFFSET + newSession.size);
+        if (!record) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+        BuiltinConnection *connection = new (record) BuiltinConnection(in, out, owner);
+        if (hasTimeouts(limits) || trace) {
+            connection->extras_ = new ConnectionExtras(*connection, wheel, owner.loop(), limits, trace);
+            if (trace) trace->carried();
+        }
+        newSession.make(static_cast<char *>(record) + SESSION_OFFSET);
+        return connection;
+    }
+
+    // Destroys connection, made for sessions of size bytes, and its session
+    static void destroy(BuiltinConnection *connection, size_t size) {
+        connection->~BuiltinConnection();
+        slabRelease(connection, SESSION_OFFSET + size);
+    }
+
+    int in() const { return in_; }
+    bool expired() const { return extras_ && extras_->timers.expired(); }
+
+    // Watches the descriptors and lets the session speak first; false
+    // (errno set) if they cannot be watched. The owner may be told the
+    // connection ended before this returns.
+    bool start() {
+        EventLoop &loop = owner_.loop();
+        if (!loop.add(in_, EPOLLIN, this)) return false;
+        if (out_ != in_ && !loop.add(out_, 0, this)) {
+            loop.remove(in_);
+            return false;
+        }
+        if (extras_) extras_->timers.start();
+        if (!session()->begin(reply())) closing_ = true;
+        settle();
+        return true;
+    }
+
+    void onEvents(int fd, uint32_t events) override {
+        if (fd == out_ && said_ != BufferPool::NONE && !flush()) {
+            end();
+            return;
+        }
+        if (fd == in_ && reading() && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            ssize_t n = read(in_, readBuffer, READ_SIZE);
+            if (n > 0) {
+                if (extras_) {
+                    extras_->timers.sawInput();
+                    if (extras_->trace) extras_->trace->moved(TRACE_IN, n);
+                }
+                if (!session()->receive(readBuffer, n, reply())) closing_ = true;
+            } else if (n == 0) {
+                session()->finish(reply());
+                closing_ = true;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                end();
+                return;
+            }
+        }
+        settle();
+    }
+
+    // Last thing any handler does: the owner may destroy the connection
+    void end() {
+        if (extras_) extras_->timers.stop();
+        EventLoop &loop = owner_.loop();
+        loop.remove(in_);
+        if (out_ != in_) loop.remove(out_);
+        owner_.ended(*this);
+    }
+
+private:
+    // Where the session starts in the record
+    static const size_t SESSION_OFFSET;
+
+    BuiltinConnection(int in, int out, ConnectionOwner &owner)
+        : in_(in), out_(out), owner_(owner), extras_(nullptr), said_(BufferPool::NONE), sent_(0), closing_(false) {}
+
+    ~BuiltinConnection() {
+        session()->~BuiltinSession();
+        delete extras_;
+        if (said_ != BufferPool::NONE) threadBuffers().giveBack(said_);
+    }
+
+    BuiltinSession *session() {
+        return reinterpret_cast<BuiltinSession *>(reinterpret_cast<char *>(this) + SESSION_OFFSET);
+    }
+
+    bool reading() const { return !closing_ && said_ == BufferPool::NONE; }
+
+    // Where the session's next words go, until they are written
+    std::string &reply() {
+        if (said_ == BufferPool::NONE) said_ = threadBuffers().lend();
+        return threadBuffers().at(said_);
+    }
+
+    // Writes what it can of the reply and watches for whatever comes next
+    void settle() {
+        if (!flush() || (closing_ && said_ == BufferPool::NONE)) {
+            end();
+            return;
+        }
+        uint32_t input = reading() ? static_cast<uint32_t>(EPOLLIN) : 0;
+        uint32_t output = said_ != BufferPool::NONE ? static_cast<uint32_t>(EPOLLOUT) : 0;
+        EventLoop &loop = owner_.loop();
+        if (out_ == in_) {
+            loop.modify(in_, input | output);
+        } else {
+            loop.modify(in_, input);
+            loop.modify(out_, output);
+        }
+    }
+
+    // false once the client cannot be written to
+    bool flush() {
+        if (said_ == BufferPool::NONE) return true;
+        std::string &said = threadBuffers().at(said_);
+        while (sent_ < said.size()) {
+            ssize_t n = write(out_, said.data() + sent_, said.size() - sent_);
+            if (n > 0) {
+                sent_ += n;
+                if (extras_) {
+                    extras_->timers.sawActivity();
+                    if (extras_->trace) extras_->trace->moved(TRACE_OUT, n);
+                }
+            } else if (n < 0 && errno == EAGAIN) {
+                return true;
+            } else if (n < 0 && errno != EINTR) {
+                return false;
+            }
+        }
+        // Back to the pool, which keeps its capacity for the next reply
+        threadBuffers().giveBack(said_);
+        said_ = BufferPool::NONE;
+        sent_ = 0;
+        return true;
+    }
+
+    int in_;
+    int out_;
+    ConnectionOwner &owner_;
+    ConnectionExtras *extras_; // Null without timeouts or a trace
+    uint32_t said_; // threadBuffers() index of the reply not yet written, or NONE
+    uint32_t sent_; // Of said_
+    bool closing_; // The session is over once said_ is written
+};
+
+// Aligned for any type, as the session's space is
+const size_t BuiltinConnection::SESSION_OFFSET =
+    (sizeof(BuiltinConnection) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+void ConnectionExtras::onTimer(Timer &timer) {
+    (void)timer;
+    connection_.end();
+}
+
+// The clients of one runtime loop
+class BuiltinHost : public ClientSink, public ConnectionOwner {
+public:
+    BuiltinHost(RuntimeLoop &runtime, const SessionTimeouts &timeouts, const SessionFactory &newSession)
+        : runtime_(runtime), timeouts_(timeouts), newSession_(newSession) {}
+
+    ~BuiltinHost() {
+        for (size_t fd = 0; fd < connections_.size(); ++fd) {
+            if (!connections_[fd]) continue;
+            BuiltinConnection::destroy(connections_[fd], newSession_.size);
+            close(static_cast<int>(fd));
+        }
+    }
+
+    void serve(int client, uint64_t accepted) override {
+        if (static_cast<size_t>(client) >= connections_.size()) {
+            connections_.resize(client + 1);
+        }
+        ConnectionTrace *trace = nullptr;
+        if (tracing()) {
+            if (static_cast<size_t>(client) >= traces_.size()) traces_.resize(client + 1);
+            trace = new ConnectionTrace();
+            traces_[client].reset(trace);
+            trace->accepted(client, accepted);
+            trace->mark(TRACE_HANDOFF);
+        }
+        BuiltinConnection *connection =
+            BuiltinConnection::make(runtime_.wheel(), timeouts_, client, client, newSession_, *this, trace);
+        connections_[client] = connection;
+        if (!connection || !connection->start()) {
+            if (connection) BuiltinConnection::destroy(connection, newSession_.size);
+            connections_[client] = nullptr;
+            if (trace) traces_[client].reset();
+            close(client);
+            runtime_.finished();
+        }
+    }
+
+    EventLoop &loop() override { return runtime_.loop(); }
+
+    void ended(BuiltinConnection &connection) override {
+        int fd = connection.in();
+        BuiltinConnection::destroy(&connection, newSession_.size);
+        connections_[fd] = nullptr;
+        if (static_cast<size_t>(fd) < traces_.size() && traces_[fd]) {
+            traces_[fd]->end();
+            traces_[fd].reset();
+        }
+        close(fd);
+        runtime_.finished();
+    }
+
+private:
+    RuntimeLoop &runtime_;
+    SessionTimeouts timeouts_;
+    const SessionFactory &newSession_;
+    std::vector<BuiltinConnection *> connections_;         // By client descriptor
+    std::vector<std::unique_ptr<ConnectionTrace>> traces_; // Likewise; empty unless tracing
+};
+
+// The owner of runBuiltin's one connection
+class LastConnection : public ConnectionOwner {
+public:
+    explicit LastConnection(EventLoop &loop) : loop_(loop), done_(false) {}
+
+    // The session may end before the loop ever runs
+    bool done() const { return done_; }
+
+    EventLoop &loop() override { return loop_; }
+
+    void ended(BuiltinConnection &connection) override {
+        (void)connection;
+        done_ = true;
+        loop_.stop();
+    }
+
+private:
+    EventLoop &loop_;
+    bool done_;
+};
+
+} // namespace
+
+int runBuiltin(int in, int out, const SessionFactory &newSession, const SessionTimeouts &timeouts) {
+    EventLoop loop;
+    TimerWheel wheel(loop);
+    if (!loop.valid() || !wheel.valid()) return -1;
+    int inFlags = fcntl(in, F_GETFL);
+    int outFlags = fcntl(out, F_GETFL);
+    if (inFlags < 0 || outFlags < 0) return -1;
+    fcntl(in, F_SETFL, inFlags | O_NONBLOCK);
+    fcntl(out, F_SETFL, outFlags | O_NONBLOCK);
+
+    LastConnection owner(loop);
+    BuiltinConnection *connection =
+        BuiltinConnection::make(wheel, timeouts, in, out, newSession, owner, processTrace());
+    int result = 0;
+    if (!connection || !connection->start()) {
+        result = -1;
+    } else {
+        if (!owner.done()) loop.run();
+        if (connection->expired()) {
+            errno = ETIMEDOUT;
+            result = -1;
+        }
+    }
+    int saved = errno;
+    if (connection) BuiltinConnection::destroy(connection, newSession.size);
+    fcntl(in, F_SETFL, inFlags);
+    fcntl(out, F_SETFL, outFlags);
+    errno = saved;
+    return result;
+}
+
+int runBuiltinServer(const ListenerFactory &openListener, bool perAcceptor, const ServeOptions &options,
+                     const SessionFactory &newSession) {
+    SessionTimeouts timeouts = sessionTimeouts(options);
+    return runAcceptors(openListener, perAcceptor, options, [&](int listener, int cap) {
+        return runLoops(listener, options.threads, cap, [&](RuntimeLoop &loop) {
+            return std::unique_ptr<ClientSink>(new BuiltinHost(loop, timeouts, newSession));
+        });
+    });
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "server.hpp"
+#include "timer_wheel.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+// A program run inside mync rather than started for each connection. Each
+// call appends what the program says to out, and all of it is written to
+// the client before any more input is read.
+class BuiltinSession {
+public:
+    virtual ~BuiltinSession() {}
+    // Before any input, for programs that speak first; false ends the
+    // session once out is written
+    virtual bool begin(std::string &out) = 0;
+    // Input as it arrives, in pieces of any size; false as for begin()
+    virtual bool receive(const char *data, size_t length, std::string &out) = 0;
+    // The client will send nothing more; the session ends once out is written
+    virtual void finish(std::string &out) = 0;
+};
+
+// Makes the session for one connection. It is built in space, size bytes
+// aligned for any type at the end of the connection's own slab record, with
+// its BuiltinSession at the start, and destroyed in place when the
+// connection ends.
+struct SessionFactory {
+    size_t size;
+    std::function<BuiltinSession *(void *space)> make;
+};
+
+// Runs one session reading in and writing out, which may be the same
+// descriptor, until it ends. Both are made non-blocking for the while.
+// Returns 0, or -1 with errno set: ETIMEDOUT if a timeout expired.
+int runBuiltin(int in, int out, const SessionFactory &newSession, const SessionTimeouts &timeouts = NO_TIMEOUTS);
+
+// runServer for a builtin program: nothing is forked per connection.
+// Each acceptor serves its clients on options.threads event loops with
+// runLoops, a session and its timeouts being all a connection costs, so
+// the client cap and the acceptor count mean what they do for runServer
+// and the pool is unused. newSession is called on every loop's thread.
+// Returns only on failure: -1 with errno set.
+int runBuiltinServer(const ListenerFactory &openListener, bool perAcceptor, const ServeOptions &options,
+                     const SessionFactory &newSession);
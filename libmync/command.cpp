@@ -0,0 +1,190 @@
+#include "command.hpp"
+#include "event_loop.hpp"
+#include "timer_wheel.hpp"
+#include "trace.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+namespace {
+
+// Characters that mean something to sh when they are not quoted
+const char SHELL_SYNTAX[] = "|&;<>()$`*?[]{}~#\n";
+
+// Builtins with no program of the same name to run instead
+const char *const SHELL_BUILTINS[] = {".", ":", "alias", "bg", "break", "cd", "command", "continue", "eval", "exec",
+                                      "exit", "export", "fg", "getopts", "hash", "jobs", "local", "read", "readonly",
+                                      "return", "set", "shift", "source", "times", "trap", "type", "ulimit", "umask",
+                                      "unalias", "unset", "wait"};
+
+// Reserved words, which sh only recognizes where a command starts
+const char *const SHELL_KEYWORDS[] = {"!", "{", "}", "[[", "]]", "case", "do", "done", "elif", "else", "esac", "fi",
+                                      "for", "function", "if", "in", "select", "then", "time", "until", "while"};
+
+bool needsShell(const std::string &line, std::vector<std::string> &words) {
+    std::string word;
+    bool inWord = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (c == ' ' || c == '\t') {
+            if (inWord) words.push_back(word);
+            word.clear();
+            inWord = false;
+            continue;
+        }
+        if (c == '=' && words.empty() && inWord) return true; // VAR=value cmd
+        if (strchr(SHELL_SYNTAX, c)) return true;
+        inWord = true;
+        if (c == '\\') {
+            if (++i == line.size()) return true;
+            if (line[i] != '\n') word += line[i];
+        } else if (c == '\'') {
+            size_t end = line.find('\'', i + 1);
+            if (end == std::string::npos) return true; // Let sh report it
+            word.append(line, i + 1, end - i - 1);
+            i = end;
+        } else if (c == '"') {
+            for (++i; i < line.size() && line[i] != '"'; ++i) {
+                if (line[i] == '$' || line[i] == '`') return true;
+                // Inside double quotes a backslash only escapes these
+                if (line[i] == '\\' && i + 1 < line.size() && strchr("\\\"\n", line[i + 1])) ++i;
+                word += line[i];
+            }
+            if (i == line.size()) return true;
+        } else {
+            word += c;
+        }
+    }
+    if (inWord) words.push_back(word);
+    if (words.empty()) return true;
+    for (const char *builtin : SHELL_BUILTINS) {
+        if (words[0] == builtin) return true;
+    }
+    for (const char *keyword : SHELL_KEYWORDS) {
+        if (words[0] == keyword) return true;
+    }
+    return false;
+}
+
+std::vector<char *> argvOf(const Command &command) {
+    std::vector<char *> argv;
+    for (const std::string &arg : command.args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    return argv;
+}
+
+} // namespace
+
+Command parseCommand(const std::string &line) {
+    Command command;
+    command.shell = needsShell(line, command.args);
+    if (command.shell) {
+        command.args = {"/bin/sh", "-c", line};
+    }
+    return command;
+}
+
+void execCommand(const Command &command) {
+    std::vector<char *> argv = argvOf(command);
+    signal(SIGPIPE, SIG_DFL);
+    traceExec();
+    execvp(argv[0], argv.data());
+    traceExecFailed();
+}
+
+pid_t spawnCommand(const Command &command, int in, int out) {
+    std::vector<char *> argv = argvOf(command);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in >= 0) posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    if (out >= 0) posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attributes, &defaults);
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], &actions, &attributes, argv.data(), environ);
+    posix_spawnattr_destroy(&attributes);
+    posix_spawn_file_actions_destroy(&actions);
+    if (error != 0) {
+        errno = error;
+        return -1;
+    }
+    // posix_spawn() returns once the program has been exec'd
+    if (ConnectionTrace *trace = processTrace()) trace->mark(TRACE_EXEC);
+    return pid;
+}
+
+namespace {
+
+// Stops the loop when the program's pidfd turns readable
+class ExitWatch : public EventHandler {
+public:
+    explicit ExitWatch(EventLoop &loop) : loop_(loop), exited_(false) {}
+
+    bool exited() const { return exited_; }
+
+    void onEvents(int fd, uint32_t events) override {
+        (void)events;
+        loop_.remove(fd);
+        exited_ = true;
+        loop_.stop();
+    }
+
+private:
+    EventLoop &loop_;
+    bool exited_;
+};
+
+// Whether the program exits within timeoutMs; false with errno ETIMEDOUT
+// once the time is up, or with the errno of whatever kept the wait from
+// being timed
+bool exitsWithin(pid_t pid, uint64_t timeoutMs) {
+    int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidfd < 0) return false;
+    bool exited;
+    {
+        EventLoop loop;
+        TimerWheel wheel(loop);
+        SessionTimeouts limits = {0, 0, timeoutMs};
+        SessionTimers timers(wheel, loop, limits);
+        ExitWatch watch(loop);
+        if (!loop.valid() || !wheel.valid() || !loop.add(pidfd, EPOLLIN, &watch)) {
+            int saved = errno;
+            close(pidfd);
+            errno = saved;
+            return false;
+        }
+        timers.start();
+        loop.run();
+        exited = watch.exited();
+    }
+    close(pidfd);
+    if (!exited) errno = ETIMEDOUT;
+    return exited;
+}
+
+} // namespace
+
+int waitCommand(pid_t pid, uint64_t timeoutMs, int &status) {
+    // A wait that cannot be timed still waits, rather than passing for a
+    // timeout
+    if (timeoutMs > 0 && !exitsWithin(pid, timeoutMs) && errno == ETIMEDOUT) return -1;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// A -e command line, ready to run. Plain commands are run directly;
+// anything using shell syntax keeps going through /bin/sh -c.
+struct Command {
+    std::vector<std::string> args; // argv; the first word is looked up on PATH
+    bool shell;                    // args is {"/bin/sh", "-c", line}
+};
+
+// Splits line into words. Single quotes, double quotes and backslashes
+// quote as they do in sh. Unquoted pipes, redirections, separators,
+// globs, expansions, comments, a leading VAR=value, $ or ` inside double
+// quotes, or a builtin such as cd or exit make it a shell command instead.
+Command parseCommand(const std::string &line);
+
+// mync ignores SIGPIPE; a command is started with it back at its default.
+
+// Replaces the current process with the command; returns only on failure
+void execCommand(const Command &command);
+
+// Starts the command with posix_spawn, which avoids copying the caller's
+// page tables. Its stdin and stdout are in and out, or the caller's own
+// where those are -1. Returns the pid, or -1 with errno set.
+pid_t spawnCommand(const Command &command, int in = -1, int out = -1);
+
+// Waits for a started program to exit, for at most timeoutMs (0 waits as
+// long as it takes). Returns 0 with its wait status in status, or -1 with
+// errno set: ETIMEDOUT once the time is up, with the program left running.
+// Without a pidfd to time the wait, it waits as long as it takes.
+int waitCommand(pid_t pid, uint64_t timeoutMs, int &status);
@@ -0,0 +1,308 @@
+#include "connector.hpp"
+#include "event_loop.hpp"
+#include "timer_wheel.hpp"
+#include "trace.hpp"
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const uint64_t CACHE_TTL_MS = 30000; // getaddrinfo() does not pass on DNS TTLs
+
+struct Address {
+    sockaddr_storage storage;
+    socklen_t length;
+    int family;
+};
+
+struct CacheEntry {
+    std::vector<Address> addresses;
+    uint64_t expiresMs;
+};
+
+std::map<std::string, CacheEntry> addressCache;
+
+uint64_t monotonicMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+std::string cacheKey(const std::string &host, int port, int type) {
+    return host + '|' + std::to_string(port) + '|' + std::to_string(type);
+}
+
+// Orders addresses the way RFC 8305 races them: getaddrinfo()'s preferred
+// family first, then alternating between families
+std::vector<Address> interleave(const std::vector<Address> &sorted) {
+    std::vector<Address> first, second;
+    for (const Address &address : sorted) {
+        (address.family == sorted.front().family ? first : second).push_back(address);
+    }
+    std::vector<Address> result;
+    for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+        if (i < first.size()) result.push_back(first[i]);
+        if (i < second.size()) result.push_back(second[i]);
+    }
+    return result;
+}
+
+// Cached addresses for host:port, looked up again once stale; empty if
+// the name does not resolve
+const std::vector<Address> &resolve(const std::string &host, int port, int type) {
+    std::string key = cacheKey(host, port, type);
+    CacheEntry &entry = addressCache[key];
+    uint64_t now = monotonicMs();
+    if (!entry.addresses.empty() && now < entry.expiresMs) return entry.addresses;
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = type;
+    hints.ai_flags = AI_ADDRCONFIG;
+    addrinfo *results = nullptr;
+    std::vector<Address> found;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &results) == 0) {
+        for (addrinfo *ai = results; ai != nullptr; ai = ai->ai_next) {
+            Address address;
+            memset(&address, 0, sizeof(address));
+            memcpy(&address.storage, ai->ai_addr, ai->ai_addrlen);
+            address.length = ai->ai_addrlen;
+            address.family = ai->ai_family;
+            found.push_back(address);
+        }
+        freeaddrinfo(results);
+    }
+    entry.addresses = found.empty() ? found : interleave(found);
+    entry.expiresMs = now + CACHE_TTL_MS;
+    return entry.addresses;
+}
+
+void forget(const std::string &host, int port, int type) {
+    addressCache.erase(cacheKey(host, port, type));
+}
+
+// Races connects to a list of addresses, and starts over with a fresh
+// lookup after a backoff when they all fail. On io_uring each attempt is
+// an IORING_OP_CONNECT tagged with its descriptor, rather than a
+// non-blocking connect() waited on for writability.
+class Connector : public EventHandler, public TimerHandler, public Completion {
+public:
+    Connector(EventLoop &loop, TimerWheel &wheel, const std::string &host, int port, int type,
+              const ConnectOptions &options)
+        : loop_(loop), wheel_(wheel), host_(host), port_(port), type_(type), options_(options), round_(0),
+          next_(0), delayMs_(options.initialDelayMs), connected_(-1), lastError_(EHOSTUNREACH), finished_(false),
+          seed_(static_cast<unsigned>(getpid() ^ monotonicMs())), uring_(nullptr), handle_(0), stagger_(this),
+          backoff_(this) {
+        Uring *uring = loop_.uring();
+        if (uring && uring->supports(IORING_OP_CONNECT) && uring->supports(IORING_OP_ASYNC_CANCEL)) {
+            uring_ = uring;
+            handle_ = uring_->attach(this);
+        }
+    }
+
+    ~Connector() {
+        for (int fd : attempts_) {
+            abandon(fd);
+            close(fd);
+        }
+        if (uring_) uring_->detach(handle_);
+    }
+
+    int connected() const { return connected_; }
+    int lastError() const { return lastError_; }
+    bool finished() const { return finished_; }
+
+    void startRound() {
+        addresses_ = resolve(host_, port_, type_);
+        if (ConnectionTrace *trace = processTrace()) trace->mark(TRACE_RESOLVE);
+        next_ = 0;
+        if (addresses_.empty()) lastError_ = EHOSTUNREACH;
+        launchNext();
+    }
+
+    void onEvents(int fd, uint32_t events) override {
+        (void)events;
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) error = errno;
+        if (error == 0) {
+            win(fd);
+            return;
+        }
+        lastError_ = error;
+        drop(fd);
+        // A failed attempt hands over to the next address at once
+        launchNext();
+    }
+
+    void onCompletion(uint32_t tag, int result, uint32_t flags) override {
+        (void)flags;
+        int fd = static_cast<int>(tag);
+        if (std::find(attempts_.begin(), attempts_.end(), fd) == attempts_.end()) return;
+        if (result == 0) {
+            win(fd);
+            return;
+        }
+        lastError_ = -result;
+        drop(fd);
+        launchNext();
+    }
+
+    void onTimer(Timer &timer) override {
+        if (&timer == &backoff_) {
+            startRound();
+        } else {
+            launchNext();
+        }
+    }
+
+private:
+    // Starts the next address that gets as far as connecting, or ends the
+    // round once none are left and nothing is in flight
+    void launchNext() {
+        wheel_.cancel(stagger_);
+        while (next_ < addresses_.size()) {
+            const Address &address = addresses_[next_++];
+            int fd = socket(address.family, type_ | (uring_ ? 0 : SOCK_NONBLOCK) | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                lastError_ = errno;
+                continue;
+            }
+            if (uring_) {
+                // The address is read when the entry is submitted; addresses_
+                // stays put until the round is over
+                io_uring_sqe *sqe = uring_->prepare(IORING_OP_CONNECT, fd, Uring::userData(handle_, fd));
+                sqe->addr = reinterpret_cast<uint64_t>(&address.storage);
+                sqe->off = address.length;
+            } else if (connect(fd, reinterpret_cast<const sockaddr *>(&address.storage), address.length) == 0) {
+                win(fd); // Datagram sockets, and loopback on a good day
+                return;
+            } else if (errno != EINPROGRESS || !loop_.add(fd, EPOLLOUT, this)) {
+                lastError_ = errno;
+                close(fd);
+                continue;
+            }
+            attempts_.push_back(fd);
+            if (next_ < addresses_.size()) wheel_.schedule(stagger_, options_.staggerMs);
+            return;
+        }
+        if (attempts_.empty()) endRound();
+    }
+
+    void endRound() {
+        forget(host_, port_, type_); // The server may have moved
+        if (round_++ >= options_.retries) {
+            finish();
+            return;
+        }
+        // Jitter keeps clients that lost the same server from returning in step
+        int delay = delayMs_ / 2 + rand_r(&seed_) % (delayMs_ / 2 + 1);
+        delayMs_ = delayMs_ * 2 < options_.maxDelayMs ? delayMs_ * 2 : options_.maxDelayMs;
+        wheel_.schedule(backoff_, delay);
+    }
+
+    // Stops waiting on an attempt in flight
+    void abandon(int fd) {
+        if (uring_) {
+            uring_->cancel(Uring::userData(handle_, fd));
+        } else {
+            loop_.remove(fd);
+        }
+    }
+
+    void drop(int fd) {
+        loop_.remove(fd);
+        close(fd);
+        for (size_t i = 0; i < attempts_.size(); ++i) {
+            if (attempts_[i] == fd) {
+                attempts_.erase(attempts_.begin() + i);
+                break;
+            }
+        }
+    }
+
+    void win(int fd) {
+        for (int other : attempts_) {
+            if (other != fd) {
+                abandon(other);
+                close(other);
+            } else {
+                loop_.remove(fd);
+            }
+        }
+        attempts_.clear();
+        wheel_.cancel(stagger_);
+        connected_ = fd;
+        if (ConnectionTrace *trace = processTrace()) trace->mark(TRACE_CONNECT);
+        finish();
+    }
+
+    void finish() {
+        finished_ = true;
+        loop_.stop();
+    }
+
+    EventLoop &loop_;
+    TimerWheel &wheel_;
+    std::string host_;
+    int port_;
+    int type_;
+    ConnectOptions options_;
+    int round_;
+    std::vector<Address> addresses_;
+    size_t next_;
+    int delayMs_;
+    int connected_;
+    int lastError_;
+    bool finished_;
+    unsigned seed_;
+    Uring *uring_; // Null unless the loop runs on io_uring
+    uint32_t handle_;
+    std::vector<int> attempts_; // Connects in flight
+    Timer stagger_;
+    Timer backoff_;
+};
+
+} // namespace
+
+int connectTo(const std::string &host, int port, int type, const ConnectOptions &options) {
+    if (options.retries < 0 || options.initialDelayMs <= 0 || options.maxDelayMs <= 0 || options.staggerMs < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    EventLoop loop;
+    if (!loop.valid()) return -1;
+    TimerWheel wheel(loop);
+    if (!wheel.valid()) return -1;
+
+    Connector connector(loop, wheel, host, port, type, options);
+    connector.startRound();
+    // Datagram sockets connect without a round trip
+    if (!connector.finished()) loop.run();
+    int fd = connector.connected();
+    if (fd < 0) {
+        errno = connector.lastError();
+        return -1;
+    }
+    // The program gets the socket as its stdout and expects it blocking
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+    return fd;
+}
+
+void prefetchAddresses(const std::string &host, int port, int type) {
+    resolve(host, port, type);
+}
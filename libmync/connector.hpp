@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+
+// How connectTo keeps trying
+struct ConnectOptions {
+    int retries;        // Rounds after the first before giving up
+    int initialDelayMs; // Pause after the first failed round, doubled after each one
+    int maxDelayMs;     // Longest pause between rounds
+    int staggerMs;      // Head start each address gets before the next one is tried too
+};
+
+// 250 ms is the connection attempt delay RFC 8305 recommends
+const ConnectOptions DEFAULT_CONNECT_OPTIONS = {6, 100, 2000, 250};
+
+// Connects a socket of the given type (SOCK_STREAM or SOCK_DGRAM) to
+// host:port, which may be a name or an IPv4 or IPv6 literal.
+//
+// Addresses come from getaddrinfo() and are cached for the process (and
+// the children it forks) for a while. They are raced Happy Eyeballs style:
+// non-blocking connects start one address at a time, alternating between
+// IPv6 and IPv4, each staggerMs after the last or as soon as the last one
+// fails, and the first to connect wins. When every address fails, the
+// name is resolved afresh after a pause that doubles each round, with
+// jitter, up to maxDelayMs, so a server that is not up yet or is
+// restarting is waited for.
+//
+// Returns the connected, blocking socket, or -1 with errno set: the last
+// connect error, or EHOSTUNREACH if host never resolved.
+int connectTo(const std::string &host, int port, int type,
+              const ConnectOptions &options = DEFAULT_CONNECT_OPTIONS);
+
+// Resolves host:port into the cache ahead of time, so that connections
+// made later, or by forked children, skip the lookup
+void prefetchAddresses(const std::string &host, int port, int type);
@@ -0,0 +1,181 @@
+#include "coroutine.hpp"
+
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <new>
+
+thread_local std::string *SessionIo::out_ = nullptr;
+thread_local std::string_view SessionIo::input_;
+thread_local uint32_t SessionIo::consumed_ = 0;
+
+void *SessionTask::promise_type::operator new(size_t size, CoroutineSession &session) {
+    return session.frameFor(size);
+}
+
+void SessionTask::promise_type::operator delete(void *frame, size_t size) {
+    // Frames that fit were put in their session
+    if (size > CoroutineSession::FRAME_SPACE) slabRelease(frame, size);
+}
+
+SessionTask &SessionTask::operator=(SessionTask &&other) noexcept {
+    if (this != &other) {
+        if (handle_) handle_.destroy();
+        handle_ = other.handle_;
+        other.handle_ = nullptr;
+    }
+    return *this;
+}
+
+SessionTask::~SessionTask() {
+    if (handle_) handle_.destroy();
+}
+
+SessionIo::~SessionIo() {
+    if (kept_ != BufferPool::NONE) threadBuffers().giveBack(kept_);
+}
+
+bool SessionIo::complete() {
+    if (!(reading_ == READ_LINE ? completeLine() : completeInt())) return false;
+    reading_ = READ_NONE;
+    return true;
+}
+
+bool SessionIo::completeLine() {
+    std::string_view &line = *static_cast<std::string_view *>(target_);
+    const char *start = input_.data() + consumed_;
+    size_t available = input_.size() - consumed_;
+    const char *newline = static_cast<const char *>(memchr(start, '\n', available));
+    size_t length;
+    if (newline) {
+        length = newline - start;
+        consumed_ += length + 1;
+        if (length > 0 && start[length - 1] == '\r') --length;
+    } else if (available >= MAX_LINE) {
+        // Overlong line: handed over in pieces, none of which will parse
+        length = MAX_LINE;
+        consumed_ += length;
+    } else if (!ended_) {
+        return false;
+    } else {
+        // A final line without a newline still counts
+        length = available;
+        consumed_ += length;
+        if (length == 0) {
+            found_ = false;
+            return true;
+        }
+    }
+    line = std::string_view(start, length);
+    found_ = true;
+    return true;
+}
+
+bool SessionIo::completeInt() {
+    int &value = *static_cast<int *>(target_);
+    size_t i = consumed_;
+    while (i < input_.size() && isspace(static_cast<unsigned char>(input_[i]))) {
+        ++i;
+    }
+    size_t j = i;
+    if (j < input_.size() && (input_[j] == '+' || input_[j] == '-')) ++j;
+    bool negative = j > i && input_[i] == '-';
+    bool digits = false;
+    long long number = 0;
+    for (; j < input_.size() && isdigit(static_cast<unsigned char>(input_[j])); ++j) {
+        digits = true;
+        // Past INT_MAX + 1 the exact value no longer matters
+        if (number <= INT_MAX) number = number * 10 + (input_[j] - '0');
+    }
+    // A number ends at the first byte that cannot continue it
+    if (j == input_.size() && !ended_) {
+        consumed_ = i;
+        return false;
+    }
+    consumed_ = j;
+    if (negative) number = -number;
+    if (!digits) {
+        value = 0;
+        found_ = false;
+    } else if (number > INT_MAX || number < INT_MIN) {
+        value = number > 0 ? INT_MAX : INT_MIN;
+        found_ = false;
+    } else {
+        value = static_cast<int>(number);
+        found_ = true;
+    }
+    return true;
+}
+
+void SessionIo::take(const char *data, size_t length) {
+    if (kept_ == BufferPool::NONE) {
+        // Nothing left over: read straight from data
+        input_ = std::string_view(data, length);
+    } else {
+        std::string &kept = threadBuffers().at(kept_);
+        kept.append(data, length);
+        input_ = kept;
+    }
+    consumed_ = 0;
+}
+
+void SessionIo::keep() {
+    BufferPool &buffers = threadBuffers();
+    std::string_view rest = input_.substr(consumed_);
+    if (rest.empty()) {
+        if (kept_ != BufferPool::NONE) buffers.giveBack(kept_);
+        kept_ = BufferPool::NONE;
+    } else if (kept_ == BufferPool::NONE) {
+        kept_ = buffers.lend();
+        buffers.at(kept_).assign(rest);
+    } else if (consumed_ > 0) {
+        buffers.at(kept_).erase(0, consumed_);
+    }
+    input_ = std::string_view();
+    consumed_ = 0;
+}
+
+CoroutineSession::~CoroutineSession() {
+    // The frame goes before the space it may be in
+    task_ = SessionTask();
+}
+
+void *CoroutineSession::frameFor(size_t size) {
+    // A second coroutine would be put over the first
+    if (task_) std::terminate();
+    if (size <= FRAME_SPACE) return frame_;
+    void *frame = slabAllocate(size);
+    if (!frame) throw std::bad_alloc();
+    return frame;
+}
+
+bool CoroutineSession::begin(std::string &out) {
+    if (task_.done()) return false;
+    io_.out_ = &out;
+    task_.resume();
+    return !task_.done();
+}
+
+bool CoroutineSession::receive(const char *data, size_t length, std::string &out) {
+    // The last line read is no longer in use once the coroutine is waiting
+    // for the next, so only what it has not consumed is kept
+    io_.take(data, length);
+    bool more = wake(out);
+    io_.keep();
+    return more;
+}
+
+void CoroutineSession::finish(std::string &out) {
+    io_.take(nullptr, 0);
+    io_.ended_ = true;
+    wake(out);
+    io_.keep();
+}
+
+bool CoroutineSession::wake(std::string &out) {
+    if (task_.done()) return false;
+    if (io_.reading_ == SessionIo::READ_NONE || !io_.complete()) return true;
+    io_.out_ = &out;
+    task_.resume();
+    return !task_.done();
+}
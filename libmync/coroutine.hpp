@@ -0,0 +1,158 @@
+#pragma once
+
+#include "builtin.hpp"
+#include "slab.hpp"
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <string_view>
+
+// Builtin programs written as C++20 coroutines, in the blocking style of a
+// program reading its stdin: a read suspends the coroutine until enough of
+// the client's input has arrived, and the loop serves other connections
+// meanwhile. A session lives in its connection's slab record, its coroutine
+// frame inside the session, and a suspended session holds a buffer only
+// for input it has not consumed.
+
+class CoroutineSession;
+
+// Return type of a session coroutine. It starts suspended and is run by
+// a CoroutineSession, which owns it.
+class SessionTask {
+public:
+    struct promise_type {
+        // A session coroutine is a member function of its session taking no
+        // arguments, and its frame goes in the session
+        static void *operator new(size_t size, CoroutineSession &session);
+        static void operator delete(void *frame, size_t size);
+
+        SessionTask get_return_object() {
+            return SessionTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    SessionTask() : handle_(nullptr) {}
+    SessionTask(SessionTask &&other) noexcept : handle_(other.handle_) { other.handle_ = nullptr; }
+    SessionTask &operator=(SessionTask &&other) noexcept;
+    ~SessionTask();
+
+    explicit operator bool() const { return static_cast<bool>(handle_); }
+    bool done() const { return !handle_ || handle_.done(); }
+    void resume() { handle_.resume(); }
+
+private:
+    explicit SessionTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    SessionTask(const SessionTask &) = delete;
+    SessionTask &operator=(const SessionTask &) = delete;
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// A session's side of its connection. What is written is sent before any
+// more input is read, so writes need no co_await.
+class SessionIo {
+public:
+    // co_await gives true once the read succeeded, false at end of input
+    // or, for readInt, on input that is not a number
+    class Read {
+    public:
+        bool await_ready() { return io_.complete(); }
+        void await_suspend(std::coroutine_handle<> waiter) { (void)waiter; } // Resumed by its session
+        bool await_resume() const { return io_.found_; }
+
+    private:
+        friend class SessionIo;
+        explicit Read(SessionIo &io) : io_(io) {}
+
+        SessionIo &io_;
+    };
+
+    SessionIo() : target_(nullptr), kept_(BufferPool::NONE), reading_(READ_NONE), found_(false), ended_(false) {}
+    ~SessionIo();
+
+    // The next line without its line ending, as LineReader reads it. line
+    // points into the input and lasts until the next read.
+    Read readLine(std::string_view &line) { return startRead(READ_LINE, &line); }
+    // The next number, as `std::cin >> value` reads it; on failure value is 0
+    Read readInt(int &value) { return startRead(READ_INT, &value); }
+
+    void write(std::string_view text) { out_->append(text); }
+    void write(char c) { out_->push_back(c); }
+    // What is still to be sent, for formatting straight into
+    std::string &output() { return *out_; }
+
+private:
+    friend class CoroutineSession;
+    static const size_t MAX_LINE = 4096;
+
+    enum ReadKind : uint8_t { READ_NONE, READ_LINE, READ_INT };
+
+    Read startRead(ReadKind kind, void *target) {
+        reading_ = kind;
+        target_ = target;
+        return Read(*this);
+    }
+
+    // Finishes the read the coroutine waits in if it can
+    bool complete();
+    bool completeLine();
+    bool completeInt();
+
+    // Takes data as the input, after whatever was kept of the last
+    void take(const char *data, size_t length);
+    // Keeps what is left of the input for the next take()
+    void keep();
+
+    // Only one session runs at a time on a thread, so what it is given to
+    // work on is the thread's rather than every session's
+    static thread_local std::string *out_;       // The connection's output
+    static thread_local std::string_view input_; // What the session was handed
+    static thread_local uint32_t consumed_;      // Of input_
+
+    void *target_;      // Of the read
+    uint32_t kept_;     // threadBuffers() index of input not yet consumed, or NONE
+    ReadKind reading_;  // The read the coroutine waits in, or READ_NONE
+    bool found_;        // The last read succeeded
+    bool ended_;        // No more input will come
+};
+
+// Runs a session coroutine as a builtin program. A derived class keeps the
+// state the coroutine works on and hands the coroutine to run() from its
+// constructor; the coroutine starts in begin(). A session runs one
+// coroutine, whose frame takes up the session's own FRAME_SPACE bytes, or a
+// slab record of its own if it needs more.
+class CoroutineSession : public BuiltinSession {
+public:
+    // Room for the frames of builtin:ttt's games as GCC lays them out, which
+    // keeps a game and its connection to one 192-byte record
+    static const size_t FRAME_SPACE = 88;
+
+    ~CoroutineSession();
+
+    bool begin(std::string &out) override;
+    bool receive(const char *data, size_t length, std::string &out) override;
+    void finish(std::string &out) override;
+
+protected:
+    SessionIo &io() { return io_; }
+    void run(SessionTask task) { task_ = std::move(task); }
+
+private:
+    friend struct SessionTask::promise_type;
+
+    // Where the coroutine's frame of size bytes goes
+    void *frameFor(size_t size);
+    // Resumes the coroutine if its read can now be finished
+    bool wake(std::string &out);
+
+    SessionIo io_;
+    SessionTask task_;
+    alignas(std::max_align_t) unsigned char frame_[FRAME_SPACE];
+};
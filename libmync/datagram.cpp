@@ -0,0 +1,492 @@
+#include "datagram.hpp"
+#include "event_loop.hpp"
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace {
+
+const size_t HUGE_PAGE = 2 << 20;
+const int MAX_GSO_SEGMENTS = 64;
+const size_t MAX_GSO_BYTES = 65000; // Leaves room for headers under the 64K IP limit
+const int SOCKET_BUFFER = 4 << 20;  // Capped by net.core.[rw]mem_max
+const size_t CREDENTIALS_SPACE = CMSG_SPACE(sizeof(ucred));
+
+bool isEagain(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+// One mapping for every buffer the engine uses
+class Pool {
+public:
+    Pool(size_t size, bool hugePages) : base_(MAP_FAILED), size_(size) {
+        if (hugePages) {
+            size_t rounded = (size + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+            base_ = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (base_ != MAP_FAILED) size_ = rounded;
+        }
+        if (base_ == MAP_FAILED) {
+            base_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+    }
+
+    ~Pool() {
+        if (base_ != MAP_FAILED) munmap(base_, size_);
+    }
+
+    bool valid() const { return base_ != MAP_FAILED; }
+    char *at(size_t offset) const { return static_cast<char *>(base_) + offset; }
+
+private:
+    void *base_;
+    size_t size_;
+};
+
+// A batch of datagrams in one half of the pool, sent from head onwards
+struct Batch {
+    std::vector<mmsghdr> messages;
+    std::vector<iovec> iov;
+    std::vector<sockaddr_storage> names;
+    std::vector<char> control; // Room for each message's credentials, when they are received
+    int count;
+    int head;
+
+    explicit Batch(int size) : messages(size), iov(size), names(size), count(0), head(0) {}
+    bool pending() const { return head < count; }
+};
+
+class DatagramEngine : public EventHandler, public TimerHandler {
+public:
+    DatagramEngine(EventLoop &loop, TimerWheel &wheel, SessionTimers &timers, const DatagramOptions &options)
+        : loop_(loop), wheel_(wheel), timers_(timers), options_(options), pool_(2 * options.batch * options.size, options.hugePages),
+          in_(-1), toChild_(-1), fromChild_(-1), out_(-1), pidfd_(-1), replyToPeer_(false), havePeer_(false),
+          peerLength_(0), input_(options.batch), output_(options.batch), outputEof_(false), childGone_(false),
+          gso_(false), delay_(this), overdue_(false), gatheredHead_(0), gatheredTail_(0) {}
+
+    ~DatagramEngine() {
+        if (pidfd_ >= 0) close(pidfd_);
+    }
+
+    bool start(int in, int toChild, int fromChild, int out, pid_t child) {
+        if (!pool_.valid()) return false;
+        in_ = in;
+        toChild_ = toChild;
+        fromChild_ = fromChild;
+        out_ = out;
+        if (in_ < 0 || toChild_ < 0) in_ = toChild_ = -1;
+        if (out_ < 0 || fromChild_ < 0) out_ = fromChild_ = -1;
+        replyToPeer_ = in_ >= 0 && in_ == out_;
+        gso_ = out_ >= 0 && isUdp(out_);
+
+        // Deep queues ride out the moments the child falls behind a burst,
+        // which would otherwise drop datagrams in the kernel
+        if (in_ >= 0) {
+            setsockopt(in_, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+            setsockopt(toChild_, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+        }
+
+        pidfd_ = static_cast<int>(syscall(SYS_pidfd_open, child, 0));
+        if (pidfd_ < 0 || !loop_.add(pidfd_, EPOLLIN, this)) return false;
+        if (fromChild_ >= 0 && !coalescing()) output_.control.resize(options_.batch * CREDENTIALS_SPACE);
+        int fds[] = {in_, toChild_, fromChild_, out_};
+        for (int fd : fds) {
+            if (fd >= 0 && !watch(fd)) return false;
+        }
+        update();
+        timers_.start();
+        return true;
+    }
+
+    void onEvents(int fd, uint32_t events) override {
+        if (fd == pidfd_) {
+            childGone_ = true;
+            loop_.remove(pidfd_);
+        }
+        if (fd == in_ && (events & EPOLLIN)) receive();
+        if (fd == toChild_ && (events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) deliver();
+        if (fd == fromChild_ && (events & (EPOLLIN | EPOLLHUP))) collect();
+        if (fd == out_ && (events & EPOLLOUT)) transmit();
+        update();
+    }
+
+    // The delay for gathered output is up
+    void onTimer(Timer &timer) override {
+        (void)timer;
+        frame(true);
+        transmit();
+        update();
+    }
+
+    void restoreFlags() {
+        for (size_t i = 0; i < fds_.size(); ++i) {
+            loop_.remove(fds_[i]);
+            fcntl(fds_[i], F_SETFL, flags_[i]);
+        }
+    }
+
+private:
+    static bool isUdp(int fd) {
+        int domain = 0, type = 0;
+        socklen_t len = sizeof(domain);
+        if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0) return false;
+        len = sizeof(type);
+        if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0) return false;
+        return (domain == AF_INET || domain == AF_INET6) && type == SOCK_DGRAM;
+    }
+
+    bool watch(int fd) {
+        for (int known : fds_) {
+            if (known == fd) return true;
+        }
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return false;
+        fds_.push_back(fd);
+        flags_.push_back(flags);
+        return loop_.add(fd, 0, this);
+    }
+
+    // Points every message of the batch at its slot in the pool, ready for
+    // recvmmsg()
+    void prepare(Batch &batch, size_t base) {
+        for (int i = 0; i < options_.batch; ++i) {
+            batch.iov[i].iov_base = pool_.at(base + i * options_.size);
+            batch.iov[i].iov_len = options_.size;
+            memset(&batch.messages[i].msg_hdr, 0, sizeof(msghdr));
+            batch.messages[i].msg_hdr.msg_iov = &batch.iov[i];
+            batch.messages[i].msg_hdr.msg_iovlen = 1;
+            batch.messages[i].msg_hdr.msg_name = &batch.names[i];
+            batch.messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            if (!batch.control.empty()) {
+                batch.messages[i].msg_hdr.msg_control = &batch.control[i * CREDENTIALS_SPACE];
+                batch.messages[i].msg_hdr.msg_controllen = CREDENTIALS_SPACE;
+            }
+        }
+    }
+
+    // Shrinks each received message to what arrived, and addresses it for
+    // sending on
+    void received(Batch &batch, int count, bool toPeer) {
+        batch.count = count;
+        batch.head = 0;
+        for (int i = 0; i < count; ++i) {
+            msghdr &msg = batch.messages[i].msg_hdr;
+            batch.iov[i].iov_len = batch.messages[i].msg_len;
+            msg.msg_name = toPeer ? &peer_ : nullptr;
+            msg.msg_namelen = toPeer ? peerLength_ : 0;
+            msg.msg_control = nullptr;
+            msg.msg_controllen = 0;
+            msg.msg_flags = 0;
+        }
+    }
+
+    void receive() {
+        if (input_.pending()) return;
+        prepare(input_, 0);
+        int n = recvmmsg(in_, input_.messages.data(), options_.batch, MSG_DONTWAIT, nullptr);
+        if (n <= 0) return; // EAGAIN, or a transient error such as ECONNREFUSED
+        timers_.sawInput();
+        if (replyToPeer_) {
+            peer_ = input_.names[n - 1];
+            peerLength_ = input_.messages[n - 1].msg_hdr.msg_namelen;
+            havePeer_ = true;
+        }
+        received(input_, n, false);
+        deliver();
+    }
+
+    void deliver() {
+        while (input_.pending()) {
+            int n = sendmmsg(toChild_, &input_.messages[input_.head], input_.count - input_.head, MSG_DONTWAIT);
+            if (n > 0) {
+                input_.head += n;
+            } else if (errno != EINTR) {
+                // EAGAIN waits for room; anything else means the child closed
+                // its stdin and received datagrams have nowhere to go
+                if (!isEagain(errno)) closeInput();
+                return;
+            }
+        }
+    }
+
+    void closeInput() {
+        input_.count = input_.head = 0;
+        toChild_ = -1;
+        in_ = -1; // Still watched for replies when it is also out
+    }
+
+    bool coalescing() const { return options_.coalesce > 0 && fromChild_ >= 0; }
+    char *gathered() const { return pool_.at(options_.batch * options_.size); }
+    size_t gatherCapacity() const { return options_.batch * options_.size; }
+
+    void collect() {
+        if (coalescing()) {
+            gather();
+            return;
+        }
+        if (output_.pending() || outputEof_) return;
+        prepare(output_, options_.batch * options_.size);
+        int n = recvmmsg(fromChild_, output_.messages.data(), options_.batch, MSG_DONTWAIT, nullptr);
+        if (n < 0) {
+            if (!isEagain(errno) && errno != EINTR) outputEof_ = true;
+            return;
+        }
+        timers_.sawActivity();
+        // The channel reads as an empty datagram once the child closes it,
+        // but only the child's own datagrams, empty ones included, carry its
+        // credentials
+        int kept = 0;
+        while (kept < n && output_.messages[kept].msg_hdr.msg_controllen > 0) ++kept;
+        if (kept < n || n == 0) outputEof_ = true;
+        received(output_, kept, replyToPeer_);
+        transmit();
+    }
+
+    // Reads whatever the child has written after the bytes still waiting
+    void gather() {
+        if (output_.pending() || outputEof_) return;
+        if (gatheredHead_ > 0) {
+            memmove(gathered(), gathered() + gatheredHead_, gatheredTail_ - gatheredHead_);
+            gatheredTail_ -= gatheredHead_;
+            gatheredHead_ = 0;
+        }
+        ssize_t n = read(fromChild_, gathered() + gatheredTail_, gatherCapacity() - gatheredTail_);
+        if (n > 0) {
+            gatheredTail_ += n;
+            timers_.sawActivity();
+        } else if (n == 0 || (!isEagain(errno) && errno != EINTR)) {
+            outputEof_ = true;
+        }
+        frame(outputEof_);
+        transmit();
+    }
+
+    // Cuts waiting bytes into a batch of datagrams: full ones always, and
+    // what the delay releases once it is up (or at end of output). Bytes
+    // still waiting start the delay.
+    void frame(bool flush) {
+        if (output_.pending()) return;
+        int count = 0;
+        while (count < options_.batch && gatheredHead_ < gatheredTail_) {
+            size_t length = release(flush || outputEof_);
+            if (length == 0) break;
+            output_.iov[count].iov_base = gathered() + gatheredHead_;
+            output_.iov[count].iov_len = length;
+            msghdr &msg = output_.messages[count].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &output_.iov[count];
+            msg.msg_iovlen = 1;
+            msg.msg_name = replyToPeer_ ? &peer_ : nullptr;
+            msg.msg_namelen = replyToPeer_ ? peerLength_ : 0;
+            gatheredHead_ += length;
+            ++count;
+        }
+        output_.count = count;
+        output_.head = 0;
+        // Flushing continues over later batches until nothing is releasable
+        overdue_ = flush && release(true) > 0;
+        armTimer(!overdue_ && release(true) > 0);
+    }
+
+    // Length of the next datagram from the waiting bytes, or 0 if it must
+    // wait for more
+    size_t release(bool flush) const {
+        size_t waiting = gatheredTail_ - gatheredHead_;
+        size_t length = std::min(waiting, options_.coalesce);
+        bool full = waiting >= options_.coalesce;
+        if (!options_.lines) {
+            return (full || flush) ? length : 0;
+        }
+        const char *start = gathered() + gatheredHead_;
+        const void *newline = memrchr(start, '\n', length);
+        if (newline && (full || flush)) {
+            return static_cast<const char *>(newline) - start + 1;
+        }
+        // A line longer than a datagram is cut; a partial one waits for its end
+        return (full || outputEof_) ? length : 0;
+    }
+
+    void armTimer(bool waiting) {
+        if (!waiting) {
+            wheel_.cancel(delay_);
+        } else if (!delay_.pending()) {
+            wheel_.schedule(delay_, options_.delayMs);
+        }
+    }
+
+    void transmit() {
+        if (replyToPeer_ && !havePeer_) return;
+        while (output_.pending() || (coalescing() && gatheredHead_ < gatheredTail_ && nextFrame())) {
+            int sent = gso_ ? sendSegmented() : 0;
+            if (sent == 0) sent = sendmmsg(out_, &output_.messages[output_.head], output_.count - output_.head, MSG_DONTWAIT);
+            if (sent > 0) {
+                output_.head += sent;
+                continue;
+            }
+            if (isEagain(errno)) return;
+            if (errno == EINTR) continue;
+            // No one is listening (ECONNREFUSED) or the datagram is refused:
+            // it is lost, as it would have been for the child
+            ++output_.head;
+        }
+    }
+
+    // Frames the next batch once the last one is out; false if none is due
+    bool nextFrame() {
+        frame(overdue_);
+        return output_.pending();
+    }
+
+    // Sends the run of equal-sized datagrams at head as one GSO buffer, which
+    // the kernel segments; returns how many went, or 0 to use sendmmsg()
+    int sendSegmented() {
+        size_t segment = output_.iov[output_.head].iov_len;
+        int run = 1;
+        size_t total = segment;
+        while (output_.head + run < output_.count && run < MAX_GSO_SEGMENTS) {
+            size_t next = output_.iov[output_.head + run].iov_len;
+            // Only the last segment may be shorter
+            if (next > segment || next == 0 || total + next > MAX_GSO_BYTES) break;
+            total += next;
+            ++run;
+            if (next < segment) break;
+        }
+        if (run < 2) return 0;
+
+        msghdr msg = output_.messages[output_.head].msg_hdr;
+        msg.msg_iov = &output_.iov[output_.head];
+        msg.msg_iovlen = run;
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t size = static_cast<uint16_t>(segment);
+        memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+        if (sendmsg(out_, &msg, MSG_DONTWAIT) >= 0) return run;
+        if (errno == EINVAL || errno == EIO || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+            gso_ = false; // Not supported here; sendmmsg() it is
+            return 0;
+        }
+        return -1;
+    }
+
+    // Recomputes what each descriptor waits for and stops when finished
+    void update() {
+        for (int fd : fds_) {
+            uint32_t events = 0;
+            if (fd == in_ && !input_.pending()) events |= EPOLLIN;
+            if (fd == toChild_ && input_.pending()) events |= EPOLLOUT;
+            if (fd == fromChild_ && !output_.pending() && !outputEof_ && gatheredTail_ - gatheredHead_ < gatherCapacity()) {
+                events |= EPOLLIN;
+            }
+            if (fd == out_ && output_.pending() && (!replyToPeer_ || havePeer_)) events |= EPOLLOUT;
+            loop_.modify(fd, events);
+        }
+        // Output still queued when the child exits is sent first
+        bool outputDone = fromChild_ < 0 || (outputEof_ && !output_.pending() && gatheredHead_ == gatheredTail_) ||
+                          (replyToPeer_ && !havePeer_);
+        if (childGone_ && outputDone) loop_.stop();
+    }
+
+    EventLoop &loop_;
+    TimerWheel &wheel_;
+    SessionTimers &timers_;
+    DatagramOptions options_;
+    Pool pool_;
+    int in_, toChild_, fromChild_, out_, pidfd_;
+    bool replyToPeer_;
+    bool havePeer_;
+    sockaddr_storage peer_;
+    socklen_t peerLength_;
+    Batch input_;  // Received, not yet passed to the child
+    Batch output_; // From the child, not yet sent
+    bool outputEof_;
+    bool childGone_;
+    bool gso_;
+    Timer delay_;         // For gathered output
+    bool overdue_;        // The delay is up for bytes a full batch left behind
+    size_t gatheredHead_; // Child output gathered in the output half of the pool
+    size_t gatheredTail_; // and not yet framed
+    std::vector<int> fds_;
+    std::vector<int> flags_;
+};
+
+// The engine cannot run, and nothing else would see the child end, so it
+// is killed and reaped; returns -1 with errno as it was
+int stopChild(pid_t child) {
+    int saved = errno;
+    kill(child, SIGKILL);
+    int status;
+    waitpid(child, &status, 0);
+    errno = saved;
+    return -1;
+}
+
+} // namespace
+
+bool createDatagramChannel(int &childEnd, int &engineEnd) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) return false;
+    // Set before the child can write, so that the engine can tell its
+    // datagrams from the end of the channel
+    int on = 1;
+    if (setsockopt(fds[1], SOL_SOCKET, SO_PASSCRED, &on, sizeof(on)) < 0) {
+        int saved = errno;
+        close(fds[0]);
+        close(fds[1]);
+        errno = saved;
+        return false;
+    }
+    childEnd = fds[0];
+    engineEnd = fds[1];
+    return true;
+}
+
+int runDatagramEngine(int in, int toChild, int fromChild, int out, pid_t child, const DatagramOptions &options,
+                      const SessionTimeouts &timeouts) {
+    if (options.batch <= 0 || options.size == 0 || options.coalesce > options.size || options.delayMs < 0) {
+        errno = EINVAL;
+        return stopChild(child);
+    }
+    EventLoop loop;
+    if (!loop.valid()) return stopChild(child);
+    TimerWheel wheel(loop);
+    if (!wheel.valid()) return stopChild(child);
+
+    SessionTimers timers(wheel, loop, timeouts);
+    DatagramEngine engine(loop, wheel, timers, options);
+    int result = 0;
+    if (engine.start(in, toChild, fromChild, out, child)) {
+        loop.run();
+        if (timers.expired()) {
+            errno = ETIMEDOUT;
+            result = -1;
+        }
+    } else {
+        result = stopChild(child);
+    }
+    int saved = errno;
+    engine.restoreFlags();
+    errno = saved;
+    return result;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "timer_wheel.hpp"
+
+#include <cstddef>
+#include <sys/types.h>
+
+// Tuning for runDatagramEngine
+struct DatagramOptions {
+    int batch;      // Datagrams per recvmmsg / sendmmsg call
+    size_t size;    // Largest datagram carried; longer ones are truncated
+    bool hugePages; // Back the buffer pool with huge pages when the system has them
+    size_t coalesce; // Bytes gathered into each datagram from a child's pipe; 0 when it has a channel
+    int delayMs;     // Longest gathered output waits for more before it is sent
+    bool lines;      // Cut gathered output only after a newline, when one fits
+};
+
+const DatagramOptions DEFAULT_DATAGRAM_OPTIONS = {64, 65536, false, 0, 5, false};
+
+// Creates the SOCK_SEQPACKET pair a child uses in place of a datagram
+// socket: each read() gets one datagram and each write() sends one, as
+// with the socket itself. childEnd is for the child; engineEnd is closed
+// on exec. Returns false with errno set on failure.
+bool createDatagramChannel(int &childEnd, int &engineEnd);
+
+// Moves datagrams between sockets and a child's datagram channels, a batch
+// per system call. Datagrams received on in with recvmmsg() are passed on
+// to toChild with sendmmsg(); datagrams the child writes to fromChild are
+// collected with recvmmsg() and sent on out with sendmmsg(), or, for runs
+// of equal-sized UDP datagrams, as one GSO send the kernel segments. Every
+// buffer comes from one pool allocated up front. When in and out are the
+// same unconnected socket, output goes to the sender of the latest
+// datagram and waits until there is one.
+//
+// With options.coalesce, fromChild is a pipe instead, and its bytes are
+// gathered Nagle-style: a datagram goes once coalesce bytes are waiting,
+// once the oldest waiting byte is delayMs old, or at end of output. With
+// options.lines a datagram only ever ends after a newline (unless a line
+// is longer than coalesce), so each line arrives whole in one datagram.
+//
+// The read timeout counts datagrams received on in; the idle timeout also
+// counts what the child writes. An expired timeout ends the engine at
+// once, leaving the child to the caller.
+//
+// Any of the four descriptors may be -1. Returns once the child has exited and its output has been sent:
+// 0, or -1 with errno set: ETIMEDOUT after a timeout, otherwise the engine could not start,
+// and the child has been killed and reaped.
+int runDatagramEngine(int in, int toChild, int fromChild, int out, pid_t child,
+                      const DatagramOptions &options = DEFAULT_DATAGRAM_OPTIONS,
+                      const SessionTimeouts &timeouts = NO_TIMEOUTS);
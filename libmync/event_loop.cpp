@@ -0,0 +1,187 @@
+#include "event_loop.hpp"
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const unsigned URING_ENTRIES = 256;
+
+IoBackend backend = IO_BACKEND_EPOLL;
+
+// Polls are filed in user_data with the low bit set
+uint64_t pollData(int fd, uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) | (static_cast<uint64_t>(fd) << 1) | 1;
+}
+
+} // namespace
+
+void setIoBackend(IoBackend chosen) {
+    backend = chosen;
+}
+
+IoBackend ioBackend() {
+    return backend;
+}
+
+EventLoop::EventLoop() : epfd_(-1), stopped_(false), watched_(0) {
+    if (backend == IO_BACKEND_URING) {
+        uring_.reset(new Uring(URING_ENTRIES));
+        if (uring_->valid() && uring_->supports(IORING_OP_POLL_ADD) && uring_->supports(IORING_OP_POLL_REMOVE)) return;
+        uring_.reset();
+    }
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+}
+
+EventLoop::~EventLoop() {
+    if (epfd_ >= 0) close(epfd_);
+}
+
+bool EventLoop::add(int fd, uint32_t events, EventHandler *handler) {
+    if (fd < 0) {
+        errno = EBADF;
+        return false;
+    }
+    if (static_cast<size_t>(fd) >= watches_.size()) {
+        watches_.resize(fd + 1, Watch{nullptr, 0, false, false, 0});
+    }
+    bool alwaysReady = false;
+    if (uring_) {
+        struct stat st;
+        if (fstat(fd, &st) < 0) return false;
+        alwaysReady = S_ISREG(st.st_mode) || S_ISDIR(st.st_mode);
+        if (!alwaysReady) toArm_.push_back(fd);
+    } else {
+        // Adding is also how regular files are detected (EPERM)
+        epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            if (errno != EPERM) return false;
+            alwaysReady = true;
+        } else if (events == 0) {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        }
+    }
+    if (alwaysReady) alwaysReady_.push_back(fd);
+    Watch &watch = watches_[fd];
+    watch = Watch{handler, events, alwaysReady, false, watch.generation + 1};
+    ++watched_;
+    return true;
+}
+
+bool EventLoop::modify(int fd, uint32_t events) {
+    if (fd < 0 || static_cast<size_t>(fd) >= watches_.size() || !watches_[fd].handler) return false;
+    Watch &watch = watches_[fd];
+    if (watch.events == events) return true;
+    uint32_t previous = watch.events;
+    watch.events = events;
+    if (watch.alwaysReady) return true;
+    if (uring_) {
+        disarm(watch, fd);
+        toArm_.push_back(fd);
+        return true;
+    }
+
+    // A parked descriptor is out of the epoll set, so hangups cannot spin us
+    if (events == 0) {
+        return epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr) == 0;
+    }
+    epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    return epoll_ctl(epfd_, previous == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev) == 0;
+}
+
+void EventLoop::remove(int fd) {
+    if (fd < 0 || static_cast<size_t>(fd) >= watches_.size() || !watches_[fd].handler) return;
+    Watch &watch = watches_[fd];
+    if (watch.alwaysReady) {
+        alwaysReady_.erase(std::find(alwaysReady_.begin(), alwaysReady_.end(), fd));
+    } else if (uring_) {
+        disarm(watch, fd);
+    } else if (watch.events != 0) {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    watch = Watch{nullptr, 0, false, false, watch.generation};
+    --watched_;
+}
+
+// Cancels the poll in flight; whatever it reports later is ignored
+void EventLoop::disarm(Watch &watch, int fd) {
+    if (watch.armed) {
+        io_uring_sqe *sqe = uring_->prepare(IORING_OP_POLL_REMOVE, -1, 0);
+        sqe->addr = pollData(fd, watch.generation);
+        watch.armed = false;
+    }
+    ++watch.generation;
+}
+
+void EventLoop::run() {
+    stopped_ = false;
+    while (!stopped_ && (watched_ > 0 || (uring_ && uring_->pending() > 0))) {
+        runOnce(-1);
+    }
+}
+
+void EventLoop::runOnce(int timeout_ms) {
+    // Never sleep while an always-ready descriptor wants events
+    bool pending = false;
+    for (int fd : alwaysReady_) {
+        pending = pending || (watches_[fd].events & (EPOLLIN | EPOLLOUT));
+    }
+
+    if (uring_) {
+        runUring(timeout_ms, pending);
+    } else {
+        epoll_event events[64];
+        int n = epoll_wait(epfd_, events, 64, pending ? 0 : timeout_ms);
+        for (int i = 0; i < n && !stopped_; ++i) {
+            int fd = events[i].data.fd;
+            // Earlier handlers in this batch may have removed fd
+            if (watches_[fd].handler) {
+                watches_[fd].handler->onEvents(fd, events[i].events);
+            }
+        }
+    }
+    for (size_t i = 0; i < alwaysReady_.size() && !stopped_; ++i) {
+        int fd = alwaysReady_[i];
+        uint32_t wanted = watches_[fd].events & (EPOLLIN | EPOLLOUT);
+        if (wanted) {
+            watches_[fd].handler->onEvents(fd, wanted);
+        }
+    }
+}
+
+void EventLoop::runUring(int timeout_ms, bool pending) {
+    // One-shot polls look at the current state when armed, so arming again
+    // after every dispatch keeps events level-triggered
+    for (int fd : toArm_) {
+        Watch &watch = watches_[fd];
+        if (!watch.handler || watch.armed || watch.alwaysReady || watch.events == 0) continue;
+        io_uring_sqe *sqe = uring_->prepare(IORING_OP_POLL_ADD, fd, pollData(fd, watch.generation));
+        sqe->poll32_events = watch.events;
+        watch.armed = true;
+    }
+    toArm_.clear();
+
+    uring_->submitAndWait(pending ? 0 : timeout_ms);
+    io_uring_cqe cqe;
+    while (!stopped_ && uring_->next(cqe)) {
+        if (!(cqe.user_data & 1)) {
+            uring_->dispatch(cqe);
+            continue;
+        }
+        int fd = static_cast<int>((cqe.user_data >> 1) & 0x7fffffff);
+        Watch &watch = watches_[fd];
+        if (!watch.handler || !watch.armed || watch.generation != static_cast<uint32_t>(cqe.user_data >> 32)) continue;
+        watch.armed = false;
+        toArm_.push_back(fd);
+        uint32_t events = cqe.res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe.res);
+        watch.handler->onEvents(fd, events & (watch.events | EPOLLERR | EPOLLHUP));
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class Uring;
+
+// Receives readiness for the descriptors it registered
+class EventHandler {
+public:
+    virtual ~EventHandler() {}
+    // events is the ready subset of EPOLLIN / EPOLLOUT / EPOLLERR / EPOLLHUP
+    virtual void onEvents(int fd, uint32_t events) = 0;
+};
+
+// What event loops wait with
+enum IoBackend {
+    IO_BACKEND_EPOLL,
+    IO_BACKEND_URING // Falls back to epoll where the kernel lacks io_uring or refuses it
+};
+
+// Chooses the backend for loops created from now on, process-wide
+void setIoBackend(IoBackend backend);
+IoBackend ioBackend();
+
+// Level-triggered readiness loop over epoll or io_uring. Regular files
+// cannot be polled, so they are treated as always ready and dispatched on
+// every iteration.
+//
+// On io_uring, readiness comes from one-shot polls that are armed again
+// after each dispatch, so handlers see the same level-triggered events
+// and all of them are submitted together with the next wait. Handlers
+// that know the ring can also submit operations of their own through
+// uring(); their completions are dispatched by the same loop, and run()
+// keeps going while any are outstanding.
+class EventLoop {
+public:
+    EventLoop();
+    ~EventLoop();
+
+    bool valid() const { return epfd_ >= 0 || uring_; }
+    // The ring when the loop runs on io_uring, otherwise null
+    Uring *uring() const { return uring_.get(); }
+
+    // Watches fd for events; false (errno set) if it cannot be watched
+    bool add(int fd, uint32_t events, EventHandler *handler);
+    // Changes the events fd is watched for; 0 parks it (no wakeups at all,
+    // not even for hangups) without forgetting it
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+
+    // Dispatches events until stop() is called or nothing is watched
+    void run();
+    // Dispatches one batch of events, waiting at most timeout_ms (-1 forever)
+    void runOnce(int timeout_ms);
+    void stop() { stopped_ = true; }
+
+private:
+    struct Watch {
+        EventHandler *handler; // Null when fd is not watched
+        uint32_t events;
+        bool alwaysReady;
+        bool armed;          // io_uring: a poll is in flight
+        uint32_t generation; // io_uring: tells a current poll from a cancelled one
+    };
+
+    void runUring(int timeout_ms, bool pending);
+    void disarm(Watch &watch, int fd);
+
+    int epfd_;
+    std::unique_ptr<Uring> uring_;
+    std::vector<int> toArm_; // io_uring: descriptors that may need a poll
+    bool stopped_;
+    size_t watched_;
+    std::vector<Watch> watches_; // Indexed by fd
+    std::vector<int> alwaysReady_;
+};
@@ -0,0 +1,585 @@
+#include "relay.hpp"
+#include "event_loop.hpp"
+#include "timer_wheel.hpp"
+#include "trace.hpp"
+#include "uring.hpp"
+
+#include <cerrno>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const size_t BUFFER_SIZE = 64 << 10;
+const int PIPE_SIZE = 1 << 20;
+const size_t SENDFILE_CHUNK = 1 << 20;
+const unsigned GROUP_BUFFERS = 8; // Per direction
+const size_t GROUP_BUFFER_SIZE = 64 << 10;
+
+// How a direction moves its bytes
+enum Mode {
+    MODE_COPY,     // read() into a user-space buffer, write() out of it
+    MODE_SPLICE,   // splice() through a kernel pipe, no user-space copy
+    MODE_SENDFILE, // sendfile() straight out of a regular file
+    // io_uring, between stream sockets
+    MODE_URING_RECV,  // Multishot recv into provided buffers, send out of them
+    MODE_URING_SPLICE // Splice through a kernel pipe, each step linked behind a poll
+};
+
+// What a direction has in flight on the ring; tags are
+// direction * URING_OPS + operation
+enum UringOp { URING_IN, URING_OUT, URING_OPS };
+
+// A received buffer, partly sent
+struct Segment {
+    uint16_t id;
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct Direction {
+    int from;
+    int to;
+    bool toSocket;
+    bool keepsAlive; // The relay lasts until this direction is done
+    bool fromClient; // Reads count against the read timeout
+    Mode mode;
+    std::vector<char> buffer; // MODE_COPY
+    size_t head;
+    size_t tail;
+    int pipe[2];              // MODE_SPLICE
+    size_t piped;
+    size_t pipeCapacity;
+    bool eof;
+    bool done;
+    BufferGroup *group;           // MODE_URING_RECV
+    std::deque<Segment> segments; // MODE_URING_RECV: received, not yet sent
+    bool multishot;
+    bool receiving; // io_uring: a recv or splice into the pipe is in flight
+    bool sending;   // io_uring: a send or splice out of the pipe is in flight
+};
+
+enum FdKind { FD_OTHER, FD_FILE, FD_PIPE, FD_STREAM_SOCKET };
+
+FdKind kindOf(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) return FD_OTHER;
+    if (S_ISREG(st.st_mode)) return FD_FILE;
+    if (S_ISFIFO(st.st_mode)) return FD_PIPE;
+    if (S_ISSOCK(st.st_mode)) {
+        int type = 0;
+        socklen_t len = sizeof(type);
+        if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 && type == SOCK_STREAM) return FD_STREAM_SOCKET;
+    }
+    // Terminals, devices and datagram sockets keep the copy loop
+    return FD_OTHER;
+}
+
+bool isEagain(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK;
+}
+
+bool isUring(const Direction &d) {
+    return d.mode == MODE_URING_RECV || d.mode == MODE_URING_SPLICE;
+}
+
+// One session on a loop it may share with others. open counts the relays
+// on the loop that have not closed; the last to close stops it.
+class Relay : public EventHandler, public Completion, public TimerHandler {
+public:
+    Relay(EventLoop &loop, TimerWheel &wheel, const SessionTimeouts &timeouts, ConnectionTrace *trace, size_t &open)
+        : loop_(loop), timers_(wheel, loop, timeouts, this), trace_(trace), open_(open), uring_(nullptr), handle_(0),
+          inFlight_(0), closing_(false) {
+        Uring *uring = loop_.uring();
+        if (uring && uring->supports(IORING_OP_RECV) && uring->supports(IORING_OP_SEND) &&
+            uring->supports(IORING_OP_ASYNC_CANCEL)) {
+            uring_ = uring;
+            handle_ = uring_->attach(this);
+        }
+    }
+
+    ~Relay() {
+        if (uring_) uring_->detach(handle_);
+        for (Direction &d : directions_) {
+            if (d.mode == MODE_SPLICE || d.mode == MODE_URING_SPLICE) {
+                close(d.pipe[0]);
+                close(d.pipe[1]);
+            }
+        }
+    }
+
+    void addDirection(int from, int to, bool fromSocket, bool toSocket, bool fromClient, bool zeroCopy) {
+        if (from < 0 || to < 0) return;
+        // Piped input is delivered in full; an interactive terminal is not
+        // waited for once the sockets are done
+        bool keepsAlive = fromSocket || !isatty(from);
+        Direction d = {from, to, toSocket, keepsAlive, fromClient, MODE_COPY, std::vector<char>(), 0, 0, {-1, -1}, 0, 0,
+                       false, false, nullptr, std::deque<Segment>(), true, false, false};
+        if (uring_ && kindOf(from) == FD_STREAM_SOCKET && kindOf(to) == FD_STREAM_SOCKET) {
+            chooseUring(d, zeroCopy);
+        } else if (zeroCopy) {
+            chooseZeroCopy(d);
+        }
+        if (d.mode == MODE_COPY) {
+            d.buffer.resize(BUFFER_SIZE);
+        }
+        directions_.push_back(d);
+    }
+
+    bool start() {
+        bool anyKeepsAlive = false;
+        for (const Direction &d : directions_) {
+            anyKeepsAlive = anyKeepsAlive || d.keepsAlive;
+        }
+        for (Direction &d : directions_) {
+            d.keepsAlive = d.keepsAlive || !anyKeepsAlive;
+            if (isUring(d)) {
+                registerFile(d.from);
+                registerFile(d.to);
+            } else if (!watch(d.from) || !watch(d.to)) {
+                return false;
+            }
+        }
+        for (size_t i = 0; i < directions_.size(); ++i) {
+            if (isUring(directions_[i])) receive(i);
+        }
+        timers_.start();
+        update();
+        return true;
+    }
+
+    bool expired() const { return timers_.expired(); }
+
+    // Stops watching and restores the descriptors' flags. On io_uring what
+    // is still in flight is cancelled, and the relay only counts as closed
+    // once it has completed: the kernel may write into the buffers until then.
+    void end() {
+        if (closing_) return;
+        closing_ = true;
+        timers_.stop();
+        for (size_t i = 0; i < fds_.size(); ++i) {
+            loop_.remove(fds_[i]);
+            fcntl(fds_[i], F_SETFL, flags_[i]);
+        }
+        for (size_t i = 0; i < directions_.size(); ++i) {
+            if (directions_[i].receiving) uring_->cancel(userData(i, URING_IN));
+            if (directions_[i].sending) uring_->cancel(userData(i, URING_OUT));
+        }
+        if (inFlight_ == 0) closed();
+    }
+
+    // An expired timeout ends the session at once
+    void onTimer(Timer &timer) override {
+        (void)timer;
+        end();
+    }
+
+    void onEvents(int fd, uint32_t events) override {
+        for (Direction &d : directions_) {
+            if (d.from == fd && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                fill(d);
+                drain(d); // Optimistic write saves a trip through epoll
+            }
+            if (d.to == fd && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+                drain(d);
+            }
+        }
+        update();
+    }
+
+    void onCompletion(uint32_t tag, int result, uint32_t flags) override {
+        size_t index = tag / URING_OPS;
+        Direction &d = directions_[index];
+        bool more = flags & IORING_CQE_F_MORE;
+        if (!more) --inFlight_;
+        if (closing_) {
+            if (inFlight_ == 0) closed();
+            return;
+        }
+        if (tag % URING_OPS == URING_IN) {
+            d.receiving = d.receiving && more;
+            received(d, result, flags);
+        } else {
+            d.sending = false;
+            sent(d, index, result);
+        }
+        send(index);
+        receive(index);
+        if (!d.done && d.eof && !d.receiving && !d.sending && pending(d) == 0) {
+            if (d.toSocket) shutdown(d.to, SHUT_WR);
+            d.done = true;
+        }
+        update();
+    }
+
+private:
+    // sendfile() needs a regular file source; splice() needs both ends to
+    // be pipes, stream sockets or regular files
+    void chooseZeroCopy(Direction &d) {
+        FdKind from = kindOf(d.from), to = kindOf(d.to);
+        if (to == FD_OTHER) return;
+        if (from == FD_FILE) {
+            d.mode = MODE_SENDFILE;
+        } else if (from != FD_OTHER && openPipe(d)) {
+            d.mode = MODE_SPLICE;
+        }
+    }
+
+    // A splice on the ring runs in a kernel worker that would block on an
+    // idle socket, so each one waits behind a poll that posts nothing when
+    // it succeeds. Without zeroCopy, or lacking that, a multishot recv
+    // fills buffers from a group of the direction's own: sharing one would
+    // let a stalled direction starve the other.
+    void chooseUring(Direction &d, bool zeroCopy) {
+        if (zeroCopy && uring_->supports(IORING_OP_SPLICE) && uring_->supports(IORING_OP_POLL_ADD) &&
+            uring_->has(IORING_FEAT_CQE_SKIP) && openPipe(d)) {
+            d.mode = MODE_URING_SPLICE;
+            return;
+        }
+        std::unique_ptr<BufferGroup> group(new BufferGroup(*uring_, GROUP_BUFFERS, GROUP_BUFFER_SIZE));
+        if (!group->valid()) return;
+        d.group = group.get();
+        groups_.push_back(std::move(group));
+        d.mode = MODE_URING_RECV;
+    }
+
+    bool openPipe(Direction &d) {
+        if (pipe2(d.pipe, O_NONBLOCK | O_CLOEXEC) < 0) return false;
+        int size = fcntl(d.pipe[1], F_SETPIPE_SZ, PIPE_SIZE);
+        if (size < 0) size = fcntl(d.pipe[1], F_GETPIPE_SZ);
+        d.pipeCapacity = size > 0 ? size : 65536;
+        return true;
+    }
+
+    // Drops back to the copy loop when the kernel refuses a zero-copy call
+    // before any data has moved
+    void fallBack(Direction &d) {
+        if (d.mode == MODE_SPLICE) {
+            close(d.pipe[0]);
+            close(d.pipe[1]);
+        }
+        d.mode = MODE_COPY;
+        d.buffer.resize(BUFFER_SIZE);
+    }
+
+    static bool unsupported(int err) {
+        return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP;
+    }
+
+    size_t pending(const Direction &d) const {
+        switch (d.mode) {
+        case MODE_SPLICE:
+        case MODE_URING_SPLICE: return d.piped;
+        case MODE_URING_RECV: return d.segments.size();
+        default: return d.tail - d.head;
+        }
+    }
+
+    bool hasSpace(const Direction &d) const {
+        switch (d.mode) {
+        case MODE_SPLICE: return d.piped < d.pipeCapacity;
+        case MODE_COPY: return d.tail < d.buffer.size();
+        default: return false; // sendfile is driven by the destination
+        }
+    }
+
+    bool watch(int fd) {
+        for (int known : fds_) {
+            if (known == fd) return true;
+        }
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return false;
+        fds_.push_back(fd);
+        flags_.push_back(flags);
+        return loop_.add(fd, 0, this);
+    }
+
+    // n bytes have come in from d's source
+    void sawBytes(const Direction &d, size_t n) {
+        if (d.fromClient) {
+            timers_.sawInput();
+        } else {
+            timers_.sawActivity();
+        }
+        if (trace_) trace_->moved(d.fromClient ? TRACE_IN : TRACE_OUT, n);
+    }
+
+    void fill(Direction &d) {
+        if (d.done || d.eof || !hasSpace(d)) return;
+        ssize_t n;
+        if (d.mode == MODE_SPLICE) {
+            n = splice(d.from, nullptr, d.pipe[1], nullptr, d.pipeCapacity - d.piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0 && unsupported(errno) && d.piped == 0) {
+                fallBack(d);
+                return fill(d);
+            }
+            if (n > 0) d.piped += n;
+        } else {
+            n = read(d.from, d.buffer.data() + d.tail, d.buffer.size() - d.tail);
+            if (n > 0) d.tail += n;
+        }
+        if (n > 0) sawBytes(d, n);
+        if (n == 0 || (n < 0 && !isEagain(errno) && errno != EINTR)) {
+            d.eof = true;
+        }
+    }
+
+    void drain(Direction &d) {
+        if (d.mode == MODE_SENDFILE) {
+            drainFile(d);
+        }
+        while (!d.done && pending(d) > 0) {
+            ssize_t n;
+            if (d.mode == MODE_SPLICE) {
+                n = splice(d.pipe[0], nullptr, d.to, nullptr, d.piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0) d.piped -= n;
+            } else {
+                n = write(d.to, d.buffer.data() + d.head, d.tail - d.head);
+                if (n > 0) d.head += n;
+            }
+            if (n > 0 || (n < 0 && errno == EINTR)) continue;
+            if (n < 0 && isEagain(errno)) break;
+            // The destination is gone; nothing more can be delivered
+            d.done = true;
+        }
+        if (pending(d) == 0) {
+            d.head = d.tail = 0;
+            if (d.eof && !d.done) {
+                if (d.toSocket) shutdown(d.to, SHUT_WR);
+                d.done = true;
+            }
+        }
+    }
+
+    void drainFile(Direction &d) {
+        while (!d.done && !d.eof) {
+            ssize_t n = sendfile(d.to, d.from, nullptr, SENDFILE_CHUNK);
+            if (n > 0 || (n < 0 && errno == EINTR)) continue;
+            if (n < 0 && isEagain(errno)) return;
+            if (n < 0 && unsupported(errno)) {
+                fallBack(d);
+                return;
+            }
+            d.eof = true; // End of file, or an error either side
+        }
+    }
+
+    // Recomputes what each descriptor waits for and stops when finished
+    void update() {
+        for (size_t i = 0; i < fds_.size(); ++i) {
+            uint32_t events = 0;
+            for (const Direction &d : directions_) {
+                if (d.done || isUring(d)) continue;
+                if (d.from == fds_[i] && !d.eof && hasSpace(d)) events |= EPOLLIN;
+                if (d.to == fds_[i] && (pending(d) > 0 || (d.mode == MODE_SENDFILE && !d.eof))) events |= EPOLLOUT;
+            }
+            loop_.modify(fds_[i], events);
+        }
+        bool finished = true;
+        for (const Direction &d : directions_) {
+            finished = finished && (d.done || !d.keepsAlive);
+        }
+        if (finished) end();
+    }
+
+    void closed() {
+        for (const std::pair<int, int> &file : files_) {
+            uring_->unregisterFile(file.second);
+        }
+        if (--open_ == 0) loop_.stop();
+    }
+
+    uint64_t userData(size_t index, UringOp op) const {
+        return Uring::userData(handle_, static_cast<uint32_t>(index * URING_OPS + op));
+    }
+
+    void registerFile(int fd) {
+        for (const std::pair<int, int> &file : files_) {
+            if (file.first == fd) return;
+        }
+        files_.push_back(std::make_pair(fd, uring_->registerFile(fd)));
+    }
+
+    // The fixed-file slot of fd, or -1 when it could not be registered
+    int slotOf(int fd) const {
+        for (const std::pair<int, int> &file : files_) {
+            if (file.first == fd) return file.second;
+        }
+        return -1;
+    }
+
+    io_uring_sqe *prepare(size_t index, UringOp op, int opcode, int fd) {
+        io_uring_sqe *sqe = uring_->prepare(opcode, fd, userData(index, op));
+        int slot = slotOf(fd);
+        if (slot >= 0) {
+            sqe->fd = slot;
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        ++inFlight_;
+        return sqe;
+    }
+
+    // Queues a poll that the next entry is linked behind
+    void waitFor(int fd, uint32_t events) {
+        io_uring_sqe *sqe = uring_->prepare(IORING_OP_POLL_ADD, fd, 0);
+        int slot = slotOf(fd);
+        if (slot >= 0) {
+            sqe->fd = slot;
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        sqe->flags |= IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+        sqe->poll32_events = events;
+    }
+
+    void spliceFrom(io_uring_sqe *sqe, int from, size_t length) {
+        int slot = slotOf(from);
+        sqe->splice_fd_in = slot >= 0 ? slot : from;
+        sqe->splice_off_in = static_cast<uint64_t>(-1);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->len = static_cast<uint32_t>(length);
+        sqe->splice_flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK | (slot >= 0 ? SPLICE_F_FD_IN_FIXED : 0);
+    }
+
+    void receive(size_t index) {
+        Direction &d = directions_[index];
+        if (d.receiving || d.eof || d.done) return;
+        if (d.mode == MODE_URING_SPLICE) {
+            if (d.piped >= d.pipeCapacity) return;
+            waitFor(d.from, POLLIN);
+            spliceFrom(prepare(index, URING_IN, IORING_OP_SPLICE, d.pipe[1]), d.from, d.pipeCapacity - d.piped);
+        } else {
+            // Every buffer is waiting to be sent; sending one frees it
+            if (d.segments.size() >= GROUP_BUFFERS) return;
+            io_uring_sqe *sqe = prepare(index, URING_IN, IORING_OP_RECV, d.from);
+            sqe->flags |= IOSQE_BUFFER_SELECT;
+            sqe->buf_group = d.group->group();
+            if (d.multishot) sqe->ioprio = IORING_RECV_MULTISHOT;
+        }
+        d.receiving = true;
+    }
+
+    void send(size_t index) {
+        Direction &d = directions_[index];
+        if (d.sending || d.done || pending(d) == 0) return;
+        if (d.mode == MODE_URING_SPLICE) {
+            waitFor(d.to, POLLOUT);
+            spliceFrom(prepare(index, URING_OUT, IORING_OP_SPLICE, d.to), d.pipe[0], d.piped);
+        } else {
+            const Segment &segment = d.segments.front();
+            io_uring_sqe *sqe = prepare(index, URING_OUT, IORING_OP_SEND, d.to);
+            sqe->addr = reinterpret_cast<uint64_t>(d.group->buffer(segment.id) + segment.offset);
+            sqe->len = segment.length;
+            sqe->msg_flags = MSG_NOSIGNAL;
+        }
+        d.sending = true;
+    }
+
+    void received(Direction &d, int result, uint32_t flags) {
+        if (result > 0) {
+            if (d.mode == MODE_URING_SPLICE) {
+                d.piped += result;
+            } else {
+                uint16_t id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+                d.segments.push_back(Segment{id, 0, static_cast<uint32_t>(result)});
+            }
+            sawBytes(d, result);
+            return;
+        }
+        // Out of buffers, or the socket drained under a splice: go again
+        if (result == -ENOBUFS || result == -EAGAIN || result == -EINTR) return;
+        if (result == -EINVAL && d.mode == MODE_URING_RECV && d.multishot) {
+            d.multishot = false; // A kernel without multishot recv
+            return;
+        }
+        d.eof = true; // End of stream, or an error
+    }
+
+    void sent(Direction &d, size_t index, int result) {
+        if (result > 0) {
+            if (d.mode == MODE_URING_SPLICE) {
+                d.piped -= result;
+                return;
+            }
+            Segment &segment = d.segments.front();
+            segment.offset += result;
+            segment.length -= result;
+            if (segment.length == 0) {
+                d.group->recycle(segment.id);
+                d.segments.pop_front();
+            }
+            return;
+        }
+        if (result == -EAGAIN || result == -EINTR) return;
+        // The destination is gone; nothing more can be delivered
+        d.done = true;
+        if (d.receiving) uring_->cancel(userData(index, URING_IN));
+    }
+
+    EventLoop &loop_;
+    SessionTimers timers_;
+    ConnectionTrace *trace_; // Null unless traced
+    size_t &open_;
+    Uring *uring_; // Null unless the loop runs on io_uring
+    uint32_t handle_;
+    size_t inFlight_;
+    bool closing_;
+    std::vector<std::unique_ptr<BufferGroup>> groups_;
+    std::vector<std::pair<int, int>> files_; // Descriptor and fixed-file slot
+    std::vector<Direction> directions_;
+    std::vector<int> fds_;
+    std::vector<int> flags_;
+};
+
+// runRelays(), with the bytes of every relay going to trace
+int relayAll(const std::vector<RelayPair> &pairs, bool zeroCopy, const SessionTimeouts &timeouts,
+             ConnectionTrace *trace) {
+    EventLoop loop;
+    if (!loop.valid()) return -1;
+    TimerWheel wheel(loop);
+    if (!wheel.valid()) return -1;
+
+    size_t open = 0;
+    int error = 0;
+    if (trace) trace->carried();
+    std::vector<std::unique_ptr<Relay>> relays;
+    for (const RelayPair &pair : pairs) {
+        relays.emplace_back(new Relay(loop, wheel, timeouts, trace, open));
+        Relay &relay = *relays.back();
+        relay.addDirection(pair.a.in, pair.b.out, pair.a.socket, pair.b.socket, true, zeroCopy);
+        // Two terminal sides would only copy stdin to stdout twice over
+        if (pair.a.socket || pair.b.socket) {
+            relay.addDirection(pair.b.in, pair.a.out, pair.b.socket, pair.a.socket, false, zeroCopy);
+        }
+        ++open;
+        if (!relay.start()) {
+            error = errno;
+            relay.end();
+        }
+    }
+    if (open > 0) loop.run();
+    for (const std::unique_ptr<Relay> &relay : relays) {
+        if (relay->expired()) error = ETIMEDOUT;
+    }
+    if (error == 0) return 0;
+    errno = error;
+    return -1;
+}
+
+} // namespace
+
+int runRelay(const RelayEndpoint &a, const RelayEndpoint &b, bool zeroCopy, const SessionTimeouts &timeouts,
+             ConnectionTrace *trace) {
+    return relayAll(std::vector<RelayPair>(1, RelayPair{a, b}), zeroCopy, timeouts, trace);
+}
+
+int runRelays(const std::vector<RelayPair> &pairs, bool zeroCopy, const SessionTimeouts &timeouts) {
+    return relayAll(pairs, zeroCopy, timeouts, nullptr);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "timer_wheel.hpp"
+#include "trace.hpp"
+
+#include <vector>
+
+// One side of a relay. A socket reads and writes the same descriptor;
+// the terminal side reads stdin and writes stdout. -1 disables a half.
+struct RelayEndpoint {
+    int in;
+    int out;
+    bool socket;
+};
+
+// Copies a.in -> b.out and b.in -> a.out at the same time, each direction
+// through its own buffer, honouring short writes and pausing reads while
+// the buffer is full. When one direction's source ends, its destination
+// is half-closed. The relay returns once every direction is finished,
+// except that a direction reading an interactive terminal is not waited
+// for when it is the only one left.
+//
+// With zeroCopy, a direction whose ends allow it skips user space: sendfile()
+// when the source is a regular file, otherwise splice() through a private
+// pipe between stream sockets, pipes and files. Terminals and datagram
+// sockets, or a kernel that refuses the call, fall back to the copy loop.
+//
+// On the io_uring backend a direction between two stream sockets runs on
+// completions instead of readiness, with both sockets as fixed files: a
+// multishot recv into kernel-picked buffers feeding sends, or with
+// zeroCopy, splices through the pipe, each queued behind a poll.
+//
+// a is the client side: the read timeout counts the bytes it sends, the
+// idle timeout bytes either way, and a trace, if given, has them as
+// TRACE_IN and the other side's as TRACE_OUT. An expired timeout ends the
+// relay at once. The caller ignores SIGPIPE, so that a side that has gone
+// away ends its direction rather than the process. Returns 0, or -1 with
+// errno set: ETIMEDOUT after a timeout, otherwise the descriptors could not
+// be polled.
+int runRelay(const RelayEndpoint &a, const RelayEndpoint &b, bool zeroCopy = true,
+             const SessionTimeouts &timeouts = NO_TIMEOUTS, ConnectionTrace *trace = nullptr);
+
+struct RelayPair {
+    RelayEndpoint a; // The client side
+    RelayEndpoint b;
+};
+
+// Runs a relay for each pair at once, all on one loop, each as runRelay()
+// would, and returns once every one is finished. Returns 0, or -1 with
+// errno set if any relay failed: ETIMEDOUT if any timed out.
+int runRelays(const std::vector<RelayPair> &pairs, bool zeroCopy = true,
+              const SessionTimeouts &timeouts = NO_TIMEOUTS);
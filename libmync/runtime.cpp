@@ -0,0 +1,342 @@
+#include "runtime.hpp"
+#include "trace.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Clients a loop starts per wakeup before its other events get a turn
+const size_t START_BATCH = 32;
+
+std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        }
+    }
+    if (cpus.empty()) cpus.push_back(0);
+    return cpus;
+}
+
+class Runtime;
+
+struct QueuedClient {
+    int fd;
+    uint64_t accepted; // For its trace; 0 when not tracing
+};
+
+// A loop, its thread's share of the work, and the queue of clients handed
+// to it but not yet started. The doorbell is how other threads wake it.
+class Worker : public RuntimeLoop, public EventHandler {
+public:
+    Worker(Runtime &runtime, size_t index, int cpu)
+        : runtime_(runtime), index_(index), cpu_(cpu), doorbell_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), load_(0),
+          queued_(0) {}
+
+    ~Worker() {
+        for (const QueuedClient &client : inbox_) {
+            close(client.fd);
+        }
+        if (doorbell_ >= 0) close(doorbell_);
+    }
+
+    bool valid() const { return doorbell_ >= 0; }
+    size_t index() const { return index_; }
+    int load() const { return load_.load(std::memory_order_relaxed); }
+    size_t queued() const { return queued_.load(std::memory_order_relaxed); }
+
+    // Runs the loop on the calling thread until the runtime stops; -1 with
+    // errno set if it cannot start
+    int run();
+
+    // From any thread
+    void ring() {
+        uint64_t one = 1;
+        ssize_t n = write(doorbell_, &one, sizeof(one));
+        (void)n; // A full counter still wakes the loop
+    }
+
+    // Queues client for this loop; from the accepting thread
+    void push(const QueuedClient &client);
+
+    // Moves up to max queued clients, oldest first, to clients and to
+    // thief's load; from any thread
+    size_t take(QueuedClient *clients, size_t max, Worker &thief);
+
+    EventLoop &loop() override { return *loop_; }
+    TimerWheel &wheel() override { return *wheel_; }
+    void finished() override;
+
+    void onEvents(int fd, uint32_t events) override;
+
+private:
+    Runtime &runtime_;
+    size_t index_;
+    int cpu_;
+    int doorbell_; // eventfd
+    std::unique_ptr<EventLoop> loop_;
+    std::unique_ptr<TimerWheel> wheel_;
+    std::unique_ptr<ClientSink> sink_;
+    std::atomic<int> load_; // Clients queued or open
+    std::atomic<size_t> queued_; // inbox_.size(), readable without the lock
+    std::mutex lock_;
+    std::deque<QueuedClient> inbox_;
+};
+
+class Runtime : public EventHandler {
+public:
+    Runtime(int listener, int threads, int cap, const SinkFactory &makeSink)
+        : listener_(listener), cap_(cap), makeSink_(makeSink), loop0_(nullptr), open_(0), paused_(false),
+          stopping_(false), error_(0), next_(0) {
+        std::vector<int> cpus = allowedCpus();
+        for (int i = 0; i < threads; ++i) {
+            workers_.emplace_back(new Worker(*this, i, cpus[i % cpus.size()]));
+        }
+    }
+
+    int run() {
+        for (const std::unique_ptr<Worker> &worker : workers_) {
+            if (!worker->valid()) return -1;
+        }
+        int flags = fcntl(listener_, F_GETFL);
+        if (flags < 0 || fcntl(listener_, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+
+        std::vector<std::thread> threads;
+        try {
+            for (size_t i = 1; i < workers_.size(); ++i) {
+                threads.emplace_back([this, i]() {
+                    if (workers_[i]->run() < 0) fail(errno);
+                });
+            }
+        } catch (const std::system_error &error) {
+            fail(error.code().value());
+        }
+        if (!stopping_ && workers_[0]->run() < 0) fail(errno);
+        // Only a failure stops the first loop; it stops the rest
+        fail(EIO);
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        errno = error_;
+        return -1;
+    }
+
+    bool pinned() const { return workers_.size() > 1; }
+    bool stopping() const { return stopping_; }
+    const SinkFactory &makeSink() const { return makeSink_; }
+
+    // Watches the listener from the first loop
+    bool attach(EventLoop &loop) {
+        loop0_ = &loop;
+        return loop.add(listener_, EPOLLIN, this);
+    }
+
+    // Ends every loop; the first error is the one reported
+    void fail(int error) {
+        int none = 0;
+        error_.compare_exchange_strong(none, error);
+        stopping_ = true;
+        for (const std::unique_ptr<Worker> &worker : workers_) {
+            worker->ring();
+        }
+    }
+
+    // A client has been closed; from any thread
+    void finished() {
+        --open_;
+        if (paused_) workers_[0]->ring();
+    }
+
+    // Starts accepting again if it was paused and may; on the first loop
+    void resume() {
+        if (paused_ && (cap_ == 0 || open_ < cap_)) {
+            paused_ = false;
+            loop0_->modify(listener_, EPOLLIN);
+        }
+    }
+
+    // Takes up to max, and at most half, of the longest queue for a loop
+    // with none of its own
+    size_t steal(Worker &thief, QueuedClient *clients, size_t max) {
+        Worker *victim = nullptr;
+        for (const std::unique_ptr<Worker> &worker : workers_) {
+            if (worker.get() != &thief && (!victim || worker->queued() > victim->queued())) {
+                victim = worker.get();
+            }
+        }
+        if (!victim || victim->queued() == 0) return 0;
+        size_t half = (victim->queued() + 1) / 2;
+        return victim->take(clients, half < max ? half : max, thief);
+    }
+
+    // A loop has more queued than it has got round to; wakes the next one
+    // to share it
+    void nudge(Worker &busy) {
+        if (workers_.size() > 1) workers_[(busy.index() + 1) % workers_.size()]->ring();
+    }
+
+    void onEvents(int fd, uint32_t events) override {
+        (void)fd;
+        (void)events;
+        while (cap_ == 0 || open_ < cap_) {
+            int client = accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client >= 0) {
+                ++open_;
+                leastLoaded().push(QueuedClient{client, tracing() ? traceClock() : 0});
+                continue;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN) return;
+            bool shortOfResources = errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM;
+            if (!shortOfResources || open_ == 0) {
+                fail(errno);
+                return;
+            }
+            // Until a client is closed
+            paused_ = true;
+            loop0_->modify(listener_, 0);
+            return;
+        }
+        // At the cap. A client closed since the check above may have missed
+        // the pause, so look again now that it is visible.
+        paused_ = true;
+        loop0_->modify(listener_, 0);
+        resume();
+    }
+
+private:
+    // Ties go round the loops
+    Worker &leastLoaded() {
+        size_t best = next_;
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            size_t candidate = (next_ + i) % workers_.size();
+            if (workers_[candidate]->load() < workers_[best]->load()) best = candidate;
+        }
+        next_ = (best + 1) % workers_.size();
+        return *workers_[best];
+    }
+
+    int listener_;
+    int cap_;
+    const SinkFactory &makeSink_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    EventLoop *loop0_; // The first loop, which accepts
+    std::atomic<int> open_;
+    std::atomic<bool> paused_;
+    std::atomic<bool> stopping_;
+    std::atomic<int> error_;
+    size_t next_;
+};
+
+int Worker::run() {
+    if (runtime_.pinned()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu_, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) return -1;
+    }
+    loop_.reset(new EventLoop());
+    if (!loop_->valid()) return -1;
+    wheel_.reset(new TimerWheel(*loop_));
+    if (!wheel_->valid() || !loop_->add(doorbell_, EPOLLIN, this)) return -1;
+    if (index_ == 0 && !runtime_.attach(*loop_)) return -1;
+    sink_ = runtime_.makeSink()(*this);
+    // Clients may have been queued before the loop was up
+    ring();
+    while (!runtime_.stopping()) {
+        loop_->run();
+    }
+    sink_.reset();
+    wheel_.reset();
+    loop_.reset();
+    return 0;
+}
+
+void Worker::push(const QueuedClient &client) {
+    bool wasEmpty;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        wasEmpty = inbox_.empty();
+        inbox_.push_back(client);
+        queued_ = inbox_.size();
+    }
+    ++load_;
+    if (wasEmpty) {
+        ring();
+    } else {
+        runtime_.nudge(*this);
+    }
+}
+
+size_t Worker::take(QueuedClient *clients, size_t max, Worker &thief) {
+    size_t n = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        while (n < max && !inbox_.empty()) {
+            clients[n++] = inbox_.front();
+            inbox_.pop_front();
+        }
+        queued_ = inbox_.size();
+    }
+    if (&thief != this) {
+        load_ -= static_cast<int>(n);
+        thief.load_ += static_cast<int>(n);
+    }
+    return n;
+}
+
+void Worker::finished() {
+    --load_;
+    runtime_.finished();
+}
+
+void Worker::onEvents(int fd, uint32_t events) {
+    (void)events;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) return;
+    if (runtime_.stopping()) {
+        loop_->stop();
+        return;
+    }
+    if (index_ == 0) runtime_.resume();
+
+    // A loop that has run out of its own clients is idle enough to start
+    // someone else's, and keeps at it while there are any
+    QueuedClient clients[START_BATCH];
+    size_t own = take(clients, START_BATCH, *this);
+    size_t stolen = own < START_BATCH ? runtime_.steal(*this, clients + own, START_BATCH - own) : 0;
+    for (size_t i = 0; i < own + stolen; ++i) {
+        sink_->serve(clients[i].fd, clients[i].accepted);
+    }
+    if (queued() > 0) {
+        ring();
+        runtime_.nudge(*this);
+    } else if (stolen > 0) {
+        ring();
+    }
+}
+
+} // namespace
+
+int availableCpus() {
+    return static_cast<int>(allowedCpus().size());
+}
+
+int runLoops(int listener, int threads, int cap, const SinkFactory &makeSink) {
+    return Runtime(listener, threads > 1 ? threads : 1, cap, makeSink).run();
+}
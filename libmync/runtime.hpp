@@ -0,0 +1,47 @@
+#pragma once
+
+#include "event_loop.hpp"
+#include "timer_wheel.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// One loop of runLoops, as the work on it sees it
+class RuntimeLoop {
+public:
+    virtual ~RuntimeLoop() {}
+    virtual EventLoop &loop() = 0;
+    virtual TimerWheel &wheel() = 0;
+    // A client handed to this loop has been closed; on the loop's thread
+    virtual void finished() = 0;
+};
+
+// What one loop does with the clients it is handed, on the loop's thread
+class ClientSink {
+public:
+    virtual ~ClientSink() {}
+    // Takes over client, a non-blocking socket accepted at the given
+    // traceClock() time, 0 when not tracing
+    virtual void serve(int client, uint64_t accepted) = 0;
+};
+
+// Makes the sink of a loop; called on that loop's thread, so on several
+// threads at once
+typedef std::function<std::unique_ptr<ClientSink>(RuntimeLoop &loop)> SinkFactory;
+
+// How many CPUs this process may run on
+int availableCpus();
+
+// Serves listener on threads event loops, each on a thread of its own
+// pinned to one of the CPUs the process may use; the calling thread runs
+// the first. That loop also accepts, handing each client to the loop with
+// the fewest clients queued or open. A loop starts its queued clients a
+// batch at a time between its other events, and a loop woken with none of
+// its own queued takes half of the longest queue instead, so clients sent
+// to a loop that is busy for a while are started by one that is not.
+// Accepting pauses while cap clients (0: no cap) are open, or while the
+// process is out of descriptors and some are. With one thread nothing is
+// pinned and no thread is started. Returns only on failure: -1 with errno
+// set.
+int runLoops(int listener, int threads, int cap, const SinkFactory &makeSink);
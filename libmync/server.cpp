@@ -0,0 +1,544 @@
+#include "server.hpp"
+#include "command.hpp"
+#include "event_loop.hpp"
+#include "relay.hpp"
+#include "trace.hpp"
+#include "uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const int REFILL_DELAY_MS = 1;
+const unsigned ACCEPT_ENTRIES = 8;
+const uint32_t EXIT_TAG = 1; // A watched child's exit, on an acceptor's ring
+
+// Forks the program in a process group of its own, so that a timeout also
+// ends whatever the shell forked. When tracing, returns once the program
+// has been exec'd, with the child's stamps taken over.
+pid_t startProgram(int io, const ClientHandler &serve) {
+    int handBack[2] = {-1, -1};
+    if (tracing() && pipe2(handBack, O_CLOEXEC) < 0) handBack[0] = handBack[1] = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        if (handBack[0] >= 0) {
+            close(handBack[0]);
+            handBackAtExec(handBack[1]);
+        }
+        serve(io);
+        _exit(EXIT_FAILURE);
+    }
+    if (pid > 0) setpgid(pid, pid);
+    if (handBack[0] >= 0) {
+        close(handBack[1]);
+        if (pid > 0) {
+            processTrace()->mark(TRACE_FORK);
+            awaitExec(handBack[0]);
+        }
+        close(handBack[0]);
+    }
+    return pid;
+}
+
+// Starts the program on one end of a socket pair; relayEnd gets the other
+pid_t startOnPair(int &relayEnd, const ClientHandler &serve) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) return -1;
+    // The program gets a plain descriptor; the handler dup2()s it
+    int programEnd = dup(pair[1]);
+    close(pair[1]);
+    pid_t program = startProgram(programEnd, serve);
+    close(programEnd);
+    if (program < 0) {
+        close(pair[0]);
+        return -1;
+    }
+    relayEnd = pair[0];
+    return program;
+}
+
+// Relays the client to its program until either side is done or a timeout
+// expires; an expired session takes the program's group down with it
+void relayToProgram(int client, int relayEnd, pid_t program, const ServeOptions &options) {
+    RelayEndpoint clientSide = {client, client, true};
+    RelayEndpoint programSide = {relayEnd, relayEnd, true};
+    ConnectionTrace *trace = processTrace();
+    // Game traffic is a few bytes a turn; splice pipes would cost more than they save
+    if (runRelay(clientSide, programSide, false, sessionTimeouts(options), trace) < 0 && errno == ETIMEDOUT) {
+        kill(-program, SIGKILL);
+    }
+    close(client);
+    close(relayEnd);
+    int status;
+    waitpid(program, &status, 0);
+    if (trace) trace->end(status);
+}
+
+// Body of a per-connection child when no pool is used
+void runConnection(int client, const ServeOptions &options, const ClientHandler &serve) {
+    SessionTimeouts timeouts = sessionTimeouts(options);
+    ConnectionTrace *trace = processTrace();
+    if (!hasTimeouts(timeouts) && !trace) {
+        serve(client); // Nothing to supervise, so the program replaces this child
+        _exit(EXIT_FAILURE);
+    }
+    if (timeouts.idleMs == 0 && timeouts.readMs == 0) {
+        // Only the lifetime is limited, so the program keeps the socket itself
+        pid_t program = startProgram(client, serve);
+        if (program < 0) _exit(EXIT_FAILURE);
+        // A trace takes the kernel's byte counts once the program is done
+        if (!trace) close(client);
+        int status;
+        if (waitCommand(program, timeouts.totalMs, status) < 0) {
+            kill(-program, SIGKILL);
+            waitpid(program, &status, 0);
+        }
+        if (trace) {
+            trace->countSockets(client, client);
+            trace->end(status);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    // Idle and read timeouts need to see the traffic
+    int relayEnd;
+    pid_t program = startOnPair(relayEnd, serve);
+    if (program < 0) _exit(EXIT_FAILURE);
+    relayToProgram(client, relayEnd, program, options);
+    _exit(EXIT_SUCCESS);
+}
+
+// The descriptor travels with the time it was accepted, 0 when not tracing
+bool sendDescriptor(int control, int fd, uint64_t accepted) {
+    iovec iov = {&accepted, sizeof(accepted)};
+    char space[CMSG_SPACE(sizeof(int))];
+    memset(space, 0, sizeof(space));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = space;
+    msg.msg_controllen = sizeof(space);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    return sendmsg(control, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(accepted));
+}
+
+// -1 once the acceptor has gone away
+int receiveDescriptor(int control, uint64_t &accepted) {
+    iovec iov = {&accepted, sizeof(accepted)};
+    char space[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = space;
+    msg.msg_controllen = sizeof(space);
+    ssize_t n;
+    do {
+        n = recvmsg(control, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) return -1;
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return fd;
+}
+
+// Body of a pool helper: starts the program at once, then waits for the
+// client it will be relayed to
+void runHelper(int control, const ServeOptions &options, const ClientHandler &serve) {
+    int relayEnd;
+    pid_t program = startOnPair(relayEnd, serve);
+    if (program < 0) _exit(EXIT_FAILURE);
+
+    uint64_t accepted = 0;
+    int client = receiveDescriptor(control, accepted);
+    close(control);
+    if (client < 0) {
+        kill(-program, SIGKILL);
+        _exit(EXIT_SUCCESS);
+    }
+    // The program was started before the connection, so its stamps are not
+    // the connection's
+    if (ConnectionTrace *trace = processTrace()) {
+        trace->accepted(client, accepted);
+        trace->mark(TRACE_HANDOFF);
+    }
+    // The timeouts start with the client, not with the program
+    relayToProgram(client, relayEnd, program, options);
+    _exit(EXIT_SUCCESS);
+}
+
+struct Helper {
+    pid_t pid;
+    int control;
+};
+
+struct Child {
+    pid_t pid;
+    int pidfd;
+};
+
+// Where an acceptor takes its clients from. On io_uring one multishot
+// accept keeps them coming without a system call each; a capped acceptor
+// arms a single accept per client instead, so that those it cannot serve
+// yet stay in the listen backlog rather than piling up here. Otherwise it
+// polls and calls accept4(). Waits also end when a watched child exits,
+// so that it is reaped at once rather than at the next client.
+class AcceptQueue : public Completion {
+public:
+    AcceptQueue(int listener, bool multishot)
+        : listener_(listener), handle_(0), armed_(false), multishot_(multishot), error_(0), exited_(false) {
+        pollfd pfd = {listener, POLLIN, 0};
+        polls_.push_back(pfd);
+        if (ioBackend() != IO_BACKEND_URING) return;
+        uring_.reset(new Uring(ACCEPT_ENTRIES));
+        if (!uring_->valid() || !uring_->supports(IORING_OP_ACCEPT)) {
+            uring_.reset();
+            return;
+        }
+        handle_ = uring_->attach(this);
+    }
+
+    ~AcceptQueue() { forget(); }
+
+    // Ends waits once the child behind pidfd exits; the descriptor stays
+    // the caller's, to be unwatched once the child is reaped
+    void watchExit(int pidfd) {
+        if (uring_) {
+            io_uring_sqe *sqe = uring_->prepare(IORING_OP_POLL_ADD, pidfd, Uring::userData(handle_, EXIT_TAG));
+            sqe->poll32_events = POLLIN;
+            return;
+        }
+        pollfd pfd = {pidfd, POLLIN, 0};
+        polls_.push_back(pfd);
+    }
+
+    void unwatchExit(int pidfd) {
+        for (size_t i = 1; i < polls_.size(); ++i) {
+            if (polls_[i].fd == pidfd) {
+                polls_.erase(polls_.begin() + i);
+                break;
+            }
+        }
+    }
+
+    // Whether a client is waiting, or a watched child has exited, after at
+    // most timeoutMs
+    bool wait(int timeoutMs) {
+        if (!uring_) return poll(polls_.data(), polls_.size(), timeoutMs) != 0;
+        arm();
+        if (ready_.empty() && error_ == 0 && !exited_) collect(timeoutMs);
+        return !ready_.empty() || error_ != 0 || exited_;
+    }
+
+    // The next client, waiting for one; -1 with errno set on failure, and
+    // EINTR when a watched child exits first
+    int next() {
+        if (!uring_) {
+            if (polls_.size() > 1) {
+                if (poll(polls_.data(), polls_.size(), -1) < 0) return -1;
+                if (!(polls_[0].revents & POLLIN)) {
+                    errno = EINTR;
+                    return -1;
+                }
+            }
+            return accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC);
+        }
+        while (ready_.empty() && error_ == 0) {
+            if (exited_) {
+                exited_ = false;
+                errno = EINTR;
+                return -1;
+            }
+            arm();
+            if (collect(-1) < 0 && errno != EINTR) return -1;
+        }
+        if (ready_.empty()) {
+            errno = error_;
+            error_ = 0;
+            return -1;
+        }
+        int client = ready_.front();
+        ready_.pop_front();
+        return client;
+    }
+
+    // Drops the ring and the clients queued so far; a forked child must,
+    // or the ring would go on accepting for a parent that has gone
+    void forget() {
+        uring_.reset();
+        for (int client : ready_) {
+            close(client);
+        }
+        ready_.clear();
+    }
+
+    void onCompletion(uint32_t tag, int result, uint32_t flags) override {
+        if (tag == EXIT_TAG) {
+            exited_ = true;
+            return;
+        }
+        if (!(flags & IORING_CQE_F_MORE)) armed_ = false;
+        if (result >= 0) {
+            ready_.push_back(result);
+        } else if (result == -EINVAL && multishot_) {
+            multishot_ = false; // A kernel without multishot accept
+        } else {
+            error_ = -result;
+        }
+    }
+
+private:
+    void arm() {
+        if (armed_) return;
+        io_uring_sqe *sqe = uring_->prepare(IORING_OP_ACCEPT, listener_, Uring::userData(handle_, 0));
+        sqe->accept_flags = SOCK_CLOEXEC;
+        if (multishot_) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        armed_ = true;
+    }
+
+    int collect(int timeoutMs) {
+        int n = uring_->submitAndWait(timeoutMs);
+        io_uring_cqe cqe;
+        while (uring_->next(cqe)) {
+            uring_->dispatch(cqe);
+        }
+        return n;
+    }
+
+    int listener_;
+    std::unique_ptr<Uring> uring_; // Null unless accepting through io_uring
+    uint32_t handle_;
+    bool armed_;
+    bool multishot_;
+    int error_; // From a failed accept, still to be reported
+    bool exited_; // A watched child has exited since next() last said so
+    std::deque<int> ready_;
+    std::vector<pollfd> polls_; // The listener, then the watched children
+};
+
+class Acceptor {
+public:
+    Acceptor(int listener, int cap, const ServeOptions &options, const ClientHandler &serve)
+        : listener_(listener), cap_(cap), active_(0), options_(options), serve_(serve), accepts_(listener, cap == 0) {}
+
+    int run() {
+        while (true) {
+            // Top up one helper at a time, and only once the listener has
+            // been quiet for a moment: a program starting up would otherwise
+            // compete for the CPU with the client just handed off
+            if (static_cast<int>(idle_.size()) < options_.pool && !accepts_.wait(REFILL_DELAY_MS)) {
+                if (!spawnHelper()) return -1;
+                continue;
+            }
+            reap(cap_ > 0 && active_ >= cap_);
+            if (cap_ > 0 && active_ >= cap_) continue;
+            int client = accepts_.next();
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return -1;
+            }
+            uint64_t accepted = 0;
+            if (ConnectionTrace *trace = processTrace()) {
+                accepted = traceClock();
+                // A forked connection starts from this; a helper from what it is sent
+                if (options_.pool == 0) trace->accepted(client, accepted);
+            }
+            bool served = options_.pool > 0 ? handOff(client, accepted) : forkConnection(client);
+            close(client);
+            if (!served) return -1;
+            ++active_;
+        }
+    }
+
+private:
+    bool forkConnection(int client) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            forgetParent();
+            runConnection(client, options_, serve_);
+        }
+        if (pid > 0) watch(pid);
+        return pid > 0;
+    }
+
+    // What a forked child must not keep of the acceptor's
+    void forgetParent() {
+        close(listener_);
+        accepts_.forget();
+        for (const Child &child : children_) {
+            close(child.pidfd);
+        }
+    }
+
+    // Has the accept loop woken when pid exits; without pidfds it is reaped
+    // at the next client instead
+    void watch(pid_t pid) {
+        int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+        if (pidfd < 0) return;
+        Child child = {pid, pidfd};
+        children_.push_back(child);
+        accepts_.watchExit(pidfd);
+    }
+
+    void unwatch(pid_t pid) {
+        for (size_t i = 0; i < children_.size(); ++i) {
+            if (children_[i].pid == pid) {
+                accepts_.unwatchExit(children_[i].pidfd);
+                close(children_[i].pidfd);
+                children_.erase(children_.begin() + i);
+                return;
+            }
+        }
+    }
+
+    bool spawnHelper() {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) return false;
+        pid_t pid = fork();
+        if (pid == 0) {
+            forgetParent();
+            close(pair[0]);
+            for (const Helper &other : idle_) {
+                close(other.control);
+            }
+            runHelper(pair[1], options_, serve_);
+        }
+        close(pair[1]);
+        if (pid < 0) {
+            close(pair[0]);
+            return false;
+        }
+        Helper helper = {pid, pair[0]};
+        idle_.push_back(helper);
+        watch(pid);
+        return true;
+    }
+
+    // Passes the client to an idle helper, skipping any that died early
+    bool handOff(int client, uint64_t accepted) {
+        while (true) {
+            if (idle_.empty() && !spawnHelper()) return false;
+            Helper helper = idle_.front();
+            idle_.erase(idle_.begin());
+            bool sent = sendDescriptor(helper.control, client, accepted);
+            close(helper.control);
+            if (sent) return true;
+        }
+    }
+
+    // Collects finished children; blocks for one when wait is set. Only
+    // helpers that had a client free up a slot.
+    void reap(bool wait) {
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, wait ? 0 : WNOHANG)) > 0) {
+            wait = false;
+            unwatch(pid);
+            bool wasIdle = false;
+            for (size_t i = 0; i < idle_.size(); ++i) {
+                if (idle_[i].pid == pid) {
+                    close(idle_[i].control);
+                    idle_.erase(idle_.begin() + i);
+                    wasIdle = true;
+                    break;
+                }
+            }
+            if (!wasIdle) --active_;
+        }
+    }
+
+    int listener_;
+    int cap_;
+    int active_;
+    ServeOptions options_;
+    const ClientHandler &serve_;
+    std::vector<Helper> idle_; // Oldest first, so the warmest program is used
+    std::vector<Child> children_;
+    AcceptQueue accepts_;
+};
+
+} // namespace
+
+SessionTimeouts sessionTimeouts(const ServeOptions &options) {
+    SessionTimeouts timeouts = {static_cast<uint64_t>(std::max(options.idleTimeout, 0)) * 1000,
+                                static_cast<uint64_t>(std::max(options.readTimeout, 0)) * 1000,
+                                static_cast<uint64_t>(std::max(options.timeout, 0)) * 1000};
+    return timeouts;
+}
+
+int runServer(const ListenerFactory &openListener, bool perAcceptor, const ServeOptions &options,
+              const ClientHandler &serve) {
+    return runAcceptors(openListener, perAcceptor, options, [&](int listener, int cap) {
+        return Acceptor(listener, cap, options, serve).run();
+    });
+}
+
+int runAcceptors(const ListenerFactory &openListener, bool perAcceptor, const ServeOptions &options,
+                 const AcceptorBody &acceptor) {
+    int acceptors = options.acceptors > 1 ? options.acceptors : 1;
+    // An acceptor with no share of the cap would never accept, so there are
+    // at most as many acceptors as clients; the first ones take what is left
+    // over from an even split
+    if (options.maxClients > 0) acceptors = std::min(acceptors, options.maxClients);
+    auto share = [&](int i) {
+        if (options.maxClients <= 0) return 0;
+        return options.maxClients / acceptors + (i < options.maxClients % acceptors ? 1 : 0);
+    };
+
+    int shared = -1;
+    if (acceptors == 1 || !perAcceptor) {
+        shared = openListener();
+        if (shared < 0) return -1;
+    }
+    if (acceptors == 1) {
+        return acceptor(shared, share(0));
+    }
+
+    // Acceptors run in their own processes; this one only supervises
+    std::vector<pid_t> children;
+    for (int i = 0; i < acceptors; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // The exit status carries errno back to the supervisor
+            int listener = perAcceptor ? openListener() : shared;
+            if (listener >= 0) acceptor(listener, share(i));
+            _exit(errno & 0xff);
+        }
+        if (pid < 0) break;
+        children.push_back(pid);
+    }
+    if (shared >= 0) close(shared);
+
+    // One failed acceptor takes the others down with it
+    int status;
+    int saved = errno;
+    if (!children.empty() && wait(&status) > 0 && WIFEXITED(status)) {
+        saved = WEXITSTATUS(status);
+    }
+    for (pid_t pid : children) {
+        kill(pid, SIGTERM);
+    }
+    while (wait(&status) > 0) {
+    }
+    errno = saved;
+    return -1;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "timer_wheel.hpp"
+
+#include <functional>
+
+// How a --serve listener is shared out
+struct ServeOptions {
+    int acceptors;   // Processes accepting in parallel
+    int maxClients;  // Connections served at once across all acceptors; 0 = no cap
+    int pool;        // Programs kept started ahead of connections, per acceptor; 0 = fork on accept
+    int timeout;     // Seconds a connection may last; 0 = no limit
+    int idleTimeout; // Seconds a connection may pass no bytes either way; 0 = no limit
+    int readTimeout; // Seconds a connection may go without the client sending; 0 = no limit
+    int threads;     // Event loops per acceptor, for programs run in process; 1 = no threads
+};
+
+// Opens a bound, listening socket; -1 with errno set on failure. Called once
+// per acceptor when each acceptor needs its own socket (SO_REUSEPORT), or
+// once in total when the acceptors share one.
+typedef std::function<int()> ListenerFactory;
+
+// Runs in a forked child and is expected to exec the program with its
+// input (and output, if the program answers the client) on the given
+// socket; if it returns, the child exits with a failure status.
+typedef std::function<void(int client)> ClientHandler;
+
+// Accepts connections until a fatal error, running the program once per
+// connection. With more than one acceptor, perAcceptor asks for a listener
+// per acceptor process so the kernel spreads new connections over them;
+// otherwise every acceptor accepts on the one listener. The client cap is
+// split over the acceptors, as evenly as it goes, each of which stops
+// accepting while it is at its share; with fewer clients allowed than
+// acceptors asked for, only that many acceptors run.
+//
+// Without a pool the program is forked once a client is accepted, so it is
+// handed the client socket itself. With a pool, each acceptor keeps that
+// many helpers whose program is already running on one end of a socket
+// pair; an accepted client is passed to an idle helper over SCM_RIGHTS and
+// relayed to its program, and the helper is replaced after the handoff.
+// serve runs at helper spawn, before any client exists, so it must not
+// set up anything per client.
+// Timeouts run on a timer wheel in the process supervising the connection.
+// With only a lifetime limit the program still gets the client socket;
+// idle and read limits need the traffic, so the connection is relayed as
+// with a pool. An expired connection has its program's whole process group
+// killed and its sockets closed, while the acceptor carries on.
+//
+// While tracing (trace.hpp) a connection that would have had nothing to
+// supervise is run as one with a lifetime limit, so that its end is seen,
+// and its supervisor waits for the program's exec before starting its
+// timeouts. Returns only on failure: -1 with errno set.
+int runServer(const ListenerFactory &openListener, bool perAcceptor, const ServeOptions &options,
+              const ClientHandler &serve);
+
+// The part of runServer that shares out the listener: runs acceptor in
+// each of the acceptor processes (or in this one, for a single acceptor)
+// with its listener and its share of the client cap, 0 meaning none.
+// acceptor returns only on failure, with errno set, which ends them all.
+typedef std::function<int(int listener, int cap)> AcceptorBody;
+int runAcceptors(const ListenerFactory &openListener, bool perAcceptor, const ServeOptions &options,
+                 const AcceptorBody &acceptor);
+
+// The serve options' limits in the timer wheel's milliseconds
+SessionTimeouts sessionTimeouts(const ServeOptions &options);
@@ -0,0 +1,104 @@
+#include "slab.hpp"
+
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace {
+
+// Pools for records of 1 to SIZE_CLASSES cache lines
+const size_t SIZE_CLASSES = 16;
+
+SlabPool *poolFor(size_t size) {
+    thread_local std::unique_ptr<SlabPool> pools[SIZE_CLASSES];
+    size_t lines = (size + CACHE_LINE - 1) / CACHE_LINE;
+    if (lines == 0) lines = 1;
+    if (lines > SIZE_CLASSES) return nullptr;
+    std::unique_ptr<SlabPool> &pool = pools[lines - 1];
+    if (!pool) pool.reset(new SlabPool(lines * CACHE_LINE));
+    return pool.get();
+}
+
+} // namespace
+
+SlabPool::SlabPool(size_t size)
+    : size_((size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE), free_(nullptr), next_(nullptr), end_(nullptr) {
+    if (size_ == 0) size_ = CACHE_LINE;
+}
+
+SlabPool::~SlabPool() {
+    for (void *slab : slabs_) {
+        free(slab);
+    }
+}
+
+void *SlabPool::allocate() {
+    if (free_) {
+        FreeRecord *record = free_;
+        free_ = record->next;
+        return record;
+    }
+    if (next_ == end_) {
+        size_t bytes = SLAB_SIZE > size_ ? SLAB_SIZE / size_ * size_ : size_;
+        void *slab = aligned_alloc(CACHE_LINE, bytes);
+        if (!slab) return nullptr;
+        slabs_.push_back(slab);
+        next_ = static_cast<char *>(slab);
+        end_ = next_ + bytes;
+    }
+    void *record = next_;
+    next_ += size_;
+    return record;
+}
+
+void SlabPool::release(void *record) {
+    if (!record) return;
+    FreeRecord *freed = static_cast<FreeRecord *>(record);
+    freed->next = free_;
+    free_ = freed;
+}
+
+void *slabAllocate(size_t size) {
+    SlabPool *pool = poolFor(size);
+    return pool ? pool->allocate() : ::operator new(size, std::nothrow);
+}
+
+void slabRelease(void *record, size_t size) {
+    SlabPool *pool = poolFor(size);
+    if (pool) {
+        pool->release(record);
+    } else {
+        ::operator delete(record);
+    }
+}
+
+void *SlabAllocated::operator new(size_t size) {
+    void *record = slabAllocate(size);
+    if (!record) throw std::bad_alloc();
+    return record;
+}
+
+uint32_t BufferPool::lend() {
+    if (free_.empty()) {
+        buffers_.emplace_back();
+        return static_cast<uint32_t>(buffers_.size() - 1);
+    }
+    uint32_t index = free_.back();
+    free_.pop_back();
+    return index;
+}
+
+void BufferPool::giveBack(uint32_t index) {
+    std::string &buffer = buffers_[index];
+    if (buffer.capacity() > MAX_KEPT) {
+        std::string().swap(buffer);
+    } else {
+        buffer.clear();
+    }
+    free_.push_back(index);
+}
+
+BufferPool &threadBuffers() {
+    thread_local BufferPool pool;
+    return pool;
+}
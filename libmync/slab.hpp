@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+const size_t CACHE_LINE = 64;
+
+// Records of one size, rounded up to whole cache lines and aligned to
+// them, carved from 64 KB slabs. A freed record is the next one handed
+// out; slabs go back to the system only with the pool, so records never
+// fragment the heap and, once a pool has grown, cost no malloc. One
+// thread's.
+class SlabPool {
+public:
+    explicit SlabPool(size_t size);
+    ~SlabPool();
+
+    size_t recordSize() const { return size_; }
+
+    // nullptr when out of memory
+    void *allocate();
+    void release(void *record);
+
+private:
+    SlabPool(const SlabPool &) = delete;
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    static const size_t SLAB_SIZE = 64 * 1024;
+
+    struct FreeRecord {
+        FreeRecord *next;
+    };
+
+    size_t size_;
+    FreeRecord *free_;
+    char *next_; // Never handed out, in the newest slab
+    char *end_;
+    std::vector<void *> slabs_;
+};
+
+// Records from the calling thread's pool for their size; sizes beyond the
+// largest pool go to operator new. For objects made and destroyed on the
+// same thread, as everything on one event loop is.
+void *slabAllocate(size_t size);
+void slabRelease(void *record, size_t size);
+
+// Base for classes whose objects live in slabAllocate() records
+class SlabAllocated {
+public:
+    static void *operator new(size_t size);
+    static void operator delete(void *record, size_t size) { slabRelease(record, size); }
+};
+
+// Byte buffers lent, by index, to connections while they hold input not
+// yet consumed or output not yet sent, so a loop needs as many as are in
+// use at once rather than one or two per connection. A buffer keeps its
+// capacity for the next borrower unless it grew past MAX_KEPT.
+class BufferPool {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+    static const size_t MAX_KEPT = 64 * 1024;
+
+    // An empty buffer; it stays where it is until given back
+    uint32_t lend();
+    std::string &at(uint32_t index) { return buffers_[index]; }
+    void giveBack(uint32_t index);
+
+private:
+    std::deque<std::string> buffers_; // Grows without moving the rest
+    std::vector<uint32_t> free_;
+};
+
+// The calling thread's pool
+BufferPool &threadBuffers();
@@ -0,0 +1,134 @@
+#include "command.hpp"
+
+#include <iostream>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+static std::string show(const std::vector<std::string> &args) {
+    std::string shown = "{";
+    for (const std::string &arg : args) {
+        shown += (shown.size() > 1 ? ", \"" : "\"") + arg + "\"";
+    }
+    return shown + "}";
+}
+
+static void expectDirect(const std::string &line, const std::vector<std::string> &args) {
+    Command command = parseCommand(line);
+    expect(!command.shell && command.args == args,
+           "[" + line + "] parsed as " + show(command.args) + (command.shell ? " for sh" : "") + " instead of " +
+               show(args));
+}
+
+static void expectShell(const std::string &line) {
+    Command command = parseCommand(line);
+    std::vector<std::string> args = {"/bin/sh", "-c", line};
+    expect(command.shell && command.args == args, "[" + line + "] not left to sh, parsed as " + show(command.args));
+}
+
+static void testWords() {
+    expectDirect("ttt 123456789", {"ttt", "123456789"});
+    expectDirect("  echo \t a   b  ", {"echo", "a", "b"});
+    expectDirect("./ttt --machine --perfect", {"./ttt", "--machine", "--perfect"});
+    expectDirect("env FOO=1 ttt", {"env", "FOO=1", "ttt"});
+    expectDirect("echo a=b", {"echo", "a=b"});
+}
+
+static void testQuoting() {
+    expectDirect("echo 'a b' \"c d\"", {"echo", "a b", "c d"});
+    expectDirect("echo a'b'\"c\"d", {"echo", "abcd"});
+    expectDirect("echo '' \"\"", {"echo", "", ""});
+    // Quoted shell syntax is only text
+    expectDirect("echo 'a|b;c' \"x>y&z\" '$HOME' '*'", {"echo", "a|b;c", "x>y&z", "$HOME", "*"});
+    // Backslashes: anything outside quotes, only \ " and newline inside
+    // double quotes, nothing inside single quotes
+    expectDirect("echo a\\ b \\| \\'", {"echo", "a b", "|", "'"});
+    expectDirect("echo \"a\\\"b\\\\c\\d\"", {"echo", "a\"b\\c\\d"});
+    expectDirect("echo 'a\\b'", {"echo", "a\\b"});
+    expectDirect("echo a\\\nb", {"echo", "ab"});
+}
+
+static void testShellFallback() {
+    // Pipes, redirections, separators, subshells and background jobs
+    expectShell("ttt 123456789 | tee log");
+    expectShell("ttt 123456789 > log");
+    expectShell("ttt 123456789 < moves");
+    expectShell("cd /tmp; ttt 123456789");
+    expectShell("ttt 123456789 && echo done");
+    expectShell("(ttt 123456789)");
+    expectShell("ttt 123456789 &");
+    // Expansions, globs and comments
+    expectShell("echo $HOME");
+    expectShell("echo \"$HOME\"");
+    expectShell("echo \"`id`\"");
+    expectShell("echo *.cpp");
+    expectShell("echo file?");
+    expectShell("echo ~");
+    expectShell("echo a # comment");
+    // Assignments, builtins and reserved words
+    expectShell("FOO=1 ttt 123456789");
+    expectShell("cd /tmp");
+    expectShell("exit 1");
+    expectShell(": nothing");
+    expectShell(". ./script");
+    expectShell("time ttt 123456789");
+    expectShell("! ttt 123456789");
+    expectShell("while true");
+    // Quoting errors are for sh to report, as is an empty line
+    expectShell("echo 'open");
+    expectShell("echo \"open");
+    expectShell("echo a\\");
+    expectShell("");
+    expectShell("   ");
+}
+
+// Output of a started command
+static std::string outputOf(const Command &command) {
+    int fds[2];
+    if (pipe(fds) < 0) return "pipe failed";
+    pid_t pid = spawnCommand(command, -1, fds[1]);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return "spawn failed";
+    }
+    std::string output;
+    char buffer[256];
+    ssize_t n;
+    while ((n = read(fds[0], buffer, sizeof(buffer))) > 0) {
+        output.append(buffer, n);
+    }
+    close(fds[0]);
+    int status;
+    waitCommand(pid, 0, status);
+    return output;
+}
+
+// A command run directly gets the words sh would have given it
+static void testSameAsShell() {
+    const char *lines[] = {"printf '[%s]' 'a b' \"c\\\"d\" e\\ f '' x\\\\y", "printf '[%s]' \"a\\b\" 'it'\\''s'"};
+    for (const char *line : lines) {
+        Command direct = parseCommand(line);
+        Command shell = {{"/bin/sh", "-c", line}, true};
+        std::string got = outputOf(direct);
+        std::string wanted = outputOf(shell);
+        expect(!direct.shell, std::string("[") + line + "] left to sh");
+        expect(got == wanted, std::string("[") + line + "] printed " + got + " instead of " + wanted);
+    }
+}
+
+int main() {
+    testWords();
+    testQuoting();
+    testShellFallback();
+    testSameAsShell();
+    if (failures == 0) std::cout << "command: ok\n";
+    return failures == 0 ? 0 : 1;
+}
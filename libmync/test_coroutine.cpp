@@ -0,0 +1,120 @@
+#include "coroutine.hpp"
+
+#include <climits>
+#include <iostream>
+#include <vector>
+
+static int failures = 0;
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Reads as its script says, 'L' for a line and 'I' for a number, and
+// writes what each read gave: "L[line]" or "L end", "I<value>" or, when
+// the read failed, "I!<value>"
+class ScriptSession : public CoroutineSession {
+public:
+    explicit ScriptSession(const std::string &script) : script_(script) { run(play()); }
+
+private:
+    SessionTask play();
+
+    std::string script_;
+};
+
+SessionTask ScriptSession::play() {
+    for (char read : script_) {
+        if (read == 'L') {
+            std::string_view line;
+            if (co_await io().readLine(line)) {
+                io().write("L[");
+                io().write(line);
+                io().write("]\n");
+            } else {
+                io().write("L end\n");
+            }
+        } else {
+            int value = -1;
+            bool found = co_await io().readInt(value);
+            io().write(found ? "I" : "I!");
+            io().write(std::to_string(value));
+            io().write('\n');
+        }
+    }
+}
+
+// What the session says given input in pieces, with finish() after them
+// unless the session ended first
+static std::string transcript(const std::string &script, const std::vector<std::string> &pieces) {
+    ScriptSession session(script);
+    std::string out;
+    bool more = session.begin(out);
+    for (const std::string &piece : pieces) {
+        if (!more) break;
+        more = session.receive(piece.data(), piece.size(), out);
+    }
+    if (more) session.finish(out);
+    return out;
+}
+
+static void expectTranscript(const std::string &script, const std::vector<std::string> &pieces,
+                             const std::string &expected, const std::string &what) {
+    std::string out = transcript(script, pieces);
+    expect(out == expected, what + ": said\n" + out + "instead of\n" + expected);
+}
+
+static void testLines() {
+    expectTranscript("LL", {"abc\ndef\n"}, "L[abc]\nL[def]\n", "two lines at once");
+    expectTranscript("LL", {"a", "b", "c\r", "\nde", "f\n"}, "L[abc]\nL[def]\n", "lines split anywhere");
+    expectTranscript("LLL", {"\n\r\n"}, "L[]\nL[]\nL end\n", "empty lines");
+    expectTranscript("LL", {"last"}, "L[last]\nL end\n", "a final line without a newline");
+    expectTranscript("L", {}, "L end\n", "no input at all");
+
+    // An overlong line comes in pieces of MAX_LINE, however it arrives
+    std::string overlong(5000, 'x');
+    std::vector<std::string> pieces;
+    for (size_t i = 0; i < overlong.size(); i += 1000) {
+        pieces.push_back(overlong.substr(i, 1000));
+    }
+    pieces.push_back("\nnext\n");
+    expectTranscript("LLL", pieces,
+                     "L[" + std::string(4096, 'x') + "]\nL[" + std::string(904, 'x') + "]\nL[next]\n",
+                     "an overlong line in pieces");
+    expectTranscript("LL", {std::string(4096, 'y')}, "L[" + std::string(4096, 'y') + "]\nL end\n",
+                     "a line of MAX_LINE without a newline");
+}
+
+static void testInts() {
+    expectTranscript("III", {"12 -34\t+56\n"}, "I12\nI-34\nI56\n", "numbers at once");
+    expectTranscript("II", {" ", "1", "2", " \n ", "-", "3"}, "I12\nI-3\n", "numbers split anywhere");
+    // A number is only over once a byte that cannot continue it arrives
+    expectTranscript("I", {"7"}, "I7\n", "a number ended by the end of input");
+    expectTranscript("II", {"42x"}, "I42\nI!0\n", "a number followed by text");
+    expectTranscript("I", {"-"}, "I!0\n", "a sign alone");
+    expectTranscript("I", {""}, "I!0\n", "no input at all");
+    expectTranscript("III", {"2147483647 -2147483648 2147483648"},
+                     "I" + std::to_string(INT_MAX) + "\nI" + std::to_string(INT_MIN) + "\nI!" +
+                         std::to_string(INT_MAX) + "\n",
+                     "the limits of int");
+    expectTranscript("I", {"-99999999999999999999"}, "I!" + std::to_string(INT_MIN) + "\n", "far below INT_MIN");
+}
+
+static void testMixed() {
+    // As with std::cin, a number leaves the rest of its line to be read
+    expectTranscript("ILL", {"5\nrest\n"}, "I5\nL[]\nL[rest]\n", "a number, then lines");
+    expectTranscript("LI", {"first line\n", "  9\n"}, "L[first line]\nI9\n", "a line, then a number");
+    // The session ends once its script does, whatever input is left
+    expectTranscript("I", {"1 2 3"}, "I1\n", "input past the end of the session");
+}
+
+int main() {
+    testLines();
+    testInts();
+    testMixed();
+    if (failures == 0) std::cout << "coroutine: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include "timer_wheel.hpp"
+
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// How late a timer may fire, for a loaded machine
+const uint64_t SLACK_MS = 50;
+
+// Records when each of its timers fired
+class Recorder : public TimerHandler {
+public:
+    struct Entry {
+        Timer timer;
+        uint64_t delayMs;
+        uint64_t rescheduleMs; // Scheduled again from its handler, once
+        std::vector<uint64_t> fired;
+
+        Entry(Recorder *recorder, uint64_t delay, uint64_t reschedule)
+            : timer(recorder), delayMs(delay), rescheduleMs(reschedule) {}
+    };
+
+    explicit Recorder(TimerWheel &wheel) : wheel_(wheel) {}
+
+    Entry &add(uint64_t delayMs, uint64_t rescheduleMs = 0) {
+        entries_.emplace_back(new Entry(this, delayMs, rescheduleMs));
+        return *entries_.back();
+    }
+
+    std::vector<std::unique_ptr<Entry>> &entries() { return entries_; }
+
+    void onTimer(Timer &timer) override {
+        for (auto &entry : entries_) {
+            if (&entry->timer != &timer) continue;
+            entry->fired.push_back(wheel_.now());
+            if (entry->fired.size() == 1 && entry->rescheduleMs > 0) wheel_.schedule(timer, entry->rescheduleMs);
+        }
+    }
+
+private:
+    TimerWheel &wheel_;
+    std::vector<std::unique_ptr<Entry>> entries_;
+};
+
+// Timers on every level the wheel cascades through in a few seconds: level
+// 0 up to 63 ticks, level 1 up to 4095, level 2 beyond
+static void testCascade(const char *name) {
+    EventLoop loop;
+    TimerWheel wheel(loop);
+    expect(loop.valid() && wheel.valid(), std::string(name) + ": no wheel");
+    if (!wheel.valid()) return;
+
+    Recorder recorder(wheel);
+    const uint64_t delays[] = {0, 1, 5, 63, 64, 65, 127, 128, 200, 1000, 4095, 4096, 4200};
+    uint64_t start = wheel.now();
+    for (uint64_t delay : delays) {
+        wheel.schedule(recorder.add(delay).timer, delay);
+    }
+    // Cancelled once filed on level 1, and moved from level 1 down to 0
+    Recorder::Entry &cancelled = recorder.add(300);
+    wheel.schedule(cancelled.timer, 300);
+    wheel.cancel(cancelled.timer);
+    Recorder::Entry &moved = recorder.add(100);
+    wheel.schedule(moved.timer, 2000);
+    wheel.schedule(moved.timer, 100);
+    // Filed again from its own handler, onto level 1
+    Recorder::Entry &again = recorder.add(10, 500);
+    wheel.schedule(again.timer, 10);
+
+    while (wheel.now() < start + 4200 + 2 * SLACK_MS) {
+        loop.runOnce(static_cast<int>(SLACK_MS));
+    }
+
+    uint64_t previous = 0;
+    for (size_t i = 0; i < recorder.entries().size(); ++i) {
+        auto &entry = recorder.entries()[i];
+        std::string label = std::string(name) + ": timer due in " + std::to_string(entry->delayMs) + " ms";
+        size_t expected = &*entry == &cancelled ? 0 : (entry->rescheduleMs > 0 ? 2 : 1);
+        expect(entry->fired.size() == expected,
+               label + " fired " + std::to_string(entry->fired.size()) + " times, not " + std::to_string(expected));
+        if (entry->fired.empty() || &*entry == &cancelled) continue;
+        uint64_t late = entry->fired[0] - start - entry->delayMs;
+        expect(entry->fired[0] >= start + entry->delayMs && late <= SLACK_MS,
+               label + " fired at " + std::to_string(entry->fired[0] - start) + " ms");
+        if (entry->fired.size() == 2) {
+            uint64_t due = entry->fired[0] + entry->rescheduleMs;
+            expect(entry->fired[1] >= due && entry->fired[1] - due <= SLACK_MS,
+                   label + " fired again " + std::to_string(entry->fired[1] - entry->fired[0]) + " ms later");
+        }
+        // The plain timers were scheduled in order of their delays
+        if (i < std::size(delays)) {
+            expect(entry->fired[0] >= previous, label + " fired before an earlier timer");
+            previous = entry->fired[0];
+        }
+    }
+    expect(!cancelled.timer.pending() && !moved.timer.pending() && !again.timer.pending(),
+           std::string(name) + ": timers still pending");
+}
+
+int main() {
+    setIoBackend(IO_BACKEND_EPOLL);
+    testCascade("timerfd");
+    setIoBackend(IO_BACKEND_URING);
+    {
+        EventLoop loop;
+        if (loop.uring()) {
+            testCascade("io_uring");
+        } else {
+            std::cout << "io_uring: not available here, skipped\n";
+        }
+    }
+    if (failures == 0) std::cout << "timer wheel: ok\n";
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+#include "timer_wheel.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+const uint64_t NEVER = UINT64_MAX;
+
+uint64_t monotonicNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+} // namespace
+
+TimerWheel::TimerWheel(EventLoop &loop)
+    : loop_(loop), uring_(nullptr), handle_(0), timeoutPending_(false), deadline_(), timerfd_(-1),
+      epochNs_(monotonicNs()), current_(0), armed_(NEVER) {
+    for (int level = 0; level < LEVELS; ++level) {
+        occupied_[level] = 0;
+        for (Timer &head : slots_[level]) {
+            head.next_ = head.prev_ = &head;
+        }
+    }
+    Uring *uring = loop_.uring();
+    if (uring && uring->supports(IORING_OP_TIMEOUT) && uring->supports(IORING_OP_TIMEOUT_REMOVE)) {
+        uring_ = uring;
+        handle_ = uring_->attach(this);
+        return;
+    }
+    timerfd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timerfd_ >= 0 && !loop_.add(timerfd_, EPOLLIN, this)) {
+        close(timerfd_);
+        timerfd_ = -1;
+    }
+}
+
+TimerWheel::~TimerWheel() {
+    // Timers may outlive the wheel; leave none pointing into it
+    for (int level = 0; level < LEVELS; ++level) {
+        for (Timer &head : slots_[level]) {
+            while (head.next_ != &head) {
+                head.next_->unlink();
+            }
+            head.next_ = head.prev_ = nullptr;
+        }
+    }
+    if (uring_) {
+        armUring(NEVER);
+        uring_->detach(handle_);
+    }
+    if (timerfd_ >= 0) {
+        loop_.remove(timerfd_);
+        close(timerfd_);
+    }
+}
+
+uint64_t TimerWheel::now() const {
+    return (monotonicNs() - epochNs_) / 1000000;
+}
+
+void TimerWheel::schedule(Timer &timer, uint64_t delayMs) {
+    detach(timer);
+    timer.expires_ = std::max(now() + delayMs, current_ + 1);
+    insert(timer);
+    // A slot in a higher level is looked at when it cascades
+    uint64_t due = timer.expires_;
+    if (timer.level_ > 0) {
+        int shift = timer.level_ * SLOT_BITS;
+        due = std::max(due >> shift << shift, current_ + 1);
+    }
+    if (due < armed_) arm(due);
+}
+
+void TimerWheel::cancel(Timer &timer) {
+    detach(timer);
+}
+
+void TimerWheel::onEvents(int fd, uint32_t events) {
+    (void)events;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0) return;
+    fire();
+}
+
+void TimerWheel::onCompletion(uint32_t tag, int result, uint32_t flags) {
+    (void)tag;
+    (void)flags;
+    // Cancelled and replaced timeouts report -ECANCELED and are ignored
+    if (result != -ETIME) return;
+    timeoutPending_ = false;
+    fire();
+}
+
+void TimerWheel::fire() {
+    armed_ = NEVER;
+    advance(now());
+    arm(nextTick());
+}
+
+// Files timer by how far off it is: level l holds timers due within
+// 64^(l+1) ticks, in the slot of their level-l digit. A timer already due
+// (only when cascading) joins the slot being expired this tick.
+void TimerWheel::insert(Timer &timer) {
+    uint64_t target = timer.expires_;
+    uint64_t delta = target > current_ ? target - current_ : 0;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ull << ((level + 1) * SLOT_BITS))) {
+        ++level;
+    }
+    if (delta >= (1ull << (LEVELS * SLOT_BITS))) {
+        target = current_ + (1ull << (LEVELS * SLOT_BITS)) - 1;
+    }
+    int slot = static_cast<int>((std::max(target, current_) >> (level * SLOT_BITS)) & (SLOTS - 1));
+    Timer &head = slots_[level][slot];
+    timer.level_ = level;
+    timer.slot_ = slot;
+    timer.prev_ = head.prev_;
+    timer.next_ = &head;
+    head.prev_->next_ = &timer;
+    head.prev_ = &timer;
+    occupied_[level] |= 1ull << slot;
+}
+
+void TimerWheel::detach(Timer &timer) {
+    if (!timer.pending()) return;
+    timer.unlink();
+    Timer &head = slots_[timer.level_][timer.slot_];
+    if (head.next_ == &head) occupied_[timer.level_] &= ~(1ull << timer.slot_);
+}
+
+// Steps through the ticks up to target that have work, skipping the rest
+void TimerWheel::advance(uint64_t target) {
+    while (current_ < target) {
+        uint64_t next = nextTick();
+        if (next > target) {
+            current_ = target;
+            return;
+        }
+        current_ = next;
+        // Higher levels first, so what they hand down is cascaded again
+        int top = 0;
+        while (top < LEVELS - 1 && (current_ & ((1ull << ((top + 1) * SLOT_BITS)) - 1)) == 0) {
+            ++top;
+        }
+        for (int level = top; level > 0; --level) {
+            cascade(level, static_cast<int>((current_ >> (level * SLOT_BITS)) & (SLOTS - 1)));
+        }
+        expire(static_cast<int>(current_ & (SLOTS - 1)));
+    }
+}
+
+void TimerWheel::cascade(int level, int slot) {
+    Timer &head = slots_[level][slot];
+    while (head.next_ != &head) {
+        Timer &timer = *head.next_;
+        timer.unlink();
+        insert(timer);
+    }
+    occupied_[level] &= ~(1ull << slot);
+}
+
+void TimerWheel::expire(int slot) {
+    // Handlers may schedule or cancel any timer, this slot's included, so
+    // the slot is moved aside and emptied one timer at a time
+    Timer due;
+    Timer &head = slots_[0][slot];
+    if (head.next_ == &head) {
+        occupied_[0] &= ~(1ull << slot);
+        return;
+    }
+    due.next_ = head.next_;
+    due.prev_ = head.prev_;
+    due.next_->prev_ = &due;
+    due.prev_->next_ = &due;
+    head.next_ = head.prev_ = &head;
+    occupied_[0] &= ~(1ull << slot);
+
+    while (due.next_ != &due) {
+        Timer &timer = *due.next_;
+        timer.unlink();
+        if (timer.expires_ > current_) {
+            insert(timer);
+        } else if (timer.handler_) {
+            timer.handler_->onTimer(timer);
+        }
+    }
+    due.next_ = due.prev_ = nullptr;
+}
+
+// The first tick after current_ with a timer due or a slot to cascade
+uint64_t TimerWheel::nextTick() const {
+    uint64_t next = NEVER;
+    for (int level = 0; level < LEVELS; ++level) {
+        if (occupied_[level] == 0) continue;
+        int shift = level * SLOT_BITS;
+        uint64_t digit = current_ >> shift;
+        for (uint64_t i = 1; i <= SLOTS; ++i) {
+            if (occupied_[level] & (1ull << ((digit + i) & (SLOTS - 1)))) {
+                next = std::min(next, (digit + i) << shift);
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+void TimerWheel::arm(uint64_t tick) {
+    armed_ = tick;
+    if (uring_) {
+        armUring(tick);
+        return;
+    }
+    itimerspec spec = {};
+    if (tick != NEVER) {
+        uint64_t at = epochNs_ + tick * 1000000;
+        spec.it_value.tv_sec = at / 1000000000;
+        spec.it_value.tv_nsec = at % 1000000000;
+    }
+    timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+// Moves the one timeout in flight rather than stacking up new ones. An
+// update that loses the race with the timeout firing fails harmlessly,
+// and the firing arms the wheel again anyway.
+void TimerWheel::armUring(uint64_t tick) {
+    uint64_t userData = Uring::userData(handle_, 0);
+    if (tick == NEVER) {
+        if (!timeoutPending_) return;
+        io_uring_sqe *sqe = uring_->prepare(IORING_OP_TIMEOUT_REMOVE, -1, 0);
+        sqe->addr = userData;
+        timeoutPending_ = false;
+        return;
+    }
+    uint64_t at = epochNs_ + tick * 1000000;
+    deadline_.tv_sec = at / 1000000000;
+    deadline_.tv_nsec = at % 1000000000;
+    io_uring_sqe *sqe;
+    if (timeoutPending_) {
+        sqe = uring_->prepare(IORING_OP_TIMEOUT_REMOVE, -1, 0);
+        sqe->addr = userData;
+        sqe->addr2 = reinterpret_cast<uint64_t>(&deadline_);
+        sqe->timeout_flags = IORING_TIMEOUT_UPDATE | IORING_TIMEOUT_ABS;
+    } else {
+        sqe = uring_->prepare(IORING_OP_TIMEOUT, -1, userData);
+        sqe->addr = reinterpret_cast<uint64_t>(&deadline_);
+        sqe->len = 1;
+        sqe->timeout_flags = IORING_TIMEOUT_ABS;
+        timeoutPending_ = true;
+    }
+}
+
+SessionTimers::SessionTimers(TimerWheel &wheel, EventLoop &loop, const SessionTimeouts &limits,
+                             TimerHandler *onExpiry)
+    : wheel_(wheel), loop_(loop), onExpiry_(onExpiry), limits_(limits), started_(0), lastInput_(0), lastActivity_(0),
+      expired_(false), timer_(this) {}
+
+void SessionTimers::start() {
+    started_ = lastInput_ = lastActivity_ = wheel_.now();
+    arm();
+}
+
+void SessionTimers::stop() {
+    wheel_.cancel(timer_);
+}
+
+void SessionTimers::sawInput() {
+    if (limits_.idleMs > 0 || limits_.readMs > 0) lastInput_ = lastActivity_ = wheel_.now();
+}
+
+void SessionTimers::sawActivity() {
+    if (limits_.idleMs > 0) lastActivity_ = wheel_.now();
+}
+
+uint64_t SessionTimers::deadline() const {
+    uint64_t earliest = UINT64_MAX;
+    if (limits_.idleMs > 0 && lastActivity_ + limits_.idleMs < earliest) earliest = lastActivity_ + limits_.idleMs;
+    if (limits_.readMs > 0 && lastInput_ + limits_.readMs < earliest) earliest = lastInput_ + limits_.readMs;
+    if (limits_.totalMs > 0 && started_ + limits_.totalMs < earliest) earliest = started_ + limits_.totalMs;
+    return earliest;
+}
+
+void SessionTimers::arm() {
+    uint64_t due = deadline();
+    if (due == UINT64_MAX) return;
+    uint64_t now = wheel_.now();
+    wheel_.schedule(timer_, due > now ? due - now : 0);
+}
+
+void SessionTimers::onTimer(Timer &timer) {
+    if (deadline() > wheel_.now()) {
+        arm();
+        return;
+    }
+    expired_ = true;
+    stop();
+    if (onExpiry_) {
+        onExpiry_->onTimer(timer);
+    } else {
+        loop_.stop();
+    }
+}
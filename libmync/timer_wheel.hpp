@@ -0,0 +1,148 @@
+#pragma once
+
+#include "event_loop.hpp"
+#include "uring.hpp"
+
+#include <cstdint>
+#include <linux/time_types.h>
+
+class Timer;
+
+// Receives the timers it scheduled when they expire
+class TimerHandler {
+public:
+    virtual ~TimerHandler() {}
+    virtual void onTimer(Timer &timer) = 0;
+};
+
+// One pending deadline. Owned by whoever schedules it; a timer destroyed
+// while pending simply never fires.
+class Timer {
+public:
+    explicit Timer(TimerHandler *handler = nullptr)
+        : handler_(handler), next_(nullptr), prev_(nullptr), expires_(0), level_(0), slot_(0) {}
+    ~Timer() { unlink(); }
+
+    bool pending() const { return next_ != nullptr; }
+
+private:
+    friend class TimerWheel;
+    Timer(const Timer &) = delete;
+    Timer &operator=(const Timer &) = delete;
+
+    void unlink() {
+        if (!next_) return;
+        prev_->next_ = next_;
+        next_->prev_ = prev_;
+        next_ = prev_ = nullptr;
+    }
+
+    TimerHandler *handler_;
+    Timer *next_; // Slot list; null when not pending
+    Timer *prev_;
+    uint64_t expires_; // Tick
+    int level_;
+    int slot_;
+};
+
+// Hierarchical timing wheel with 1 ms ticks, driven by one timerfd in the
+// event loop. Four levels of 64 slots cover about 4.6 hours; a timer due
+// later than that waits in the last level and is placed again as it
+// comes into range. Scheduling and cancelling are O(1), and the timerfd is
+// only armed for the next slot that has work in it, so a wheel full of
+// idle timeouts does not wake the loop every tick. On an io_uring loop an
+// IORING_OP_TIMEOUT takes the timerfd's place, and moving it is one more
+// entry in the next submission rather than a system call.
+class TimerWheel : public EventHandler, public Completion {
+public:
+    explicit TimerWheel(EventLoop &loop);
+    ~TimerWheel();
+
+    bool valid() const { return timerfd_ >= 0 || uring_ != nullptr; }
+
+    // Milliseconds on the wheel's clock
+    uint64_t now() const;
+
+    // (Re)schedules timer to fire delayMs from now, at the earliest on the
+    // next tick
+    void schedule(Timer &timer, uint64_t delayMs);
+    void cancel(Timer &timer);
+
+    void onEvents(int fd, uint32_t events) override;
+    void onCompletion(uint32_t tag, int result, uint32_t flags) override;
+
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    void insert(Timer &timer);
+    void detach(Timer &timer);
+    void advance(uint64_t target);
+    void cascade(int level, int slot);
+    void expire(int slot);
+    uint64_t nextTick() const;
+    void arm(uint64_t tick);
+    void armUring(uint64_t tick);
+    void fire();
+
+    EventLoop &loop_;
+    Uring *uring_;
+    uint32_t handle_;
+    bool timeoutPending_;       // io_uring: the timeout is submitted and has not fired
+    __kernel_timespec deadline_; // io_uring: read by the kernel at submission
+    int timerfd_;
+    uint64_t epochNs_;   // CLOCK_MONOTONIC at tick 0
+    uint64_t current_;   // Last tick processed
+    uint64_t armed_;     // Tick the timerfd fires at; UINT64_MAX when disarmed
+    uint64_t occupied_[LEVELS]; // Bit per non-empty slot
+    Timer slots_[LEVELS][SLOTS]; // List heads
+};
+
+// Per-connection limits in milliseconds; 0 is no limit
+struct SessionTimeouts {
+    uint64_t idleMs;  // With no bytes moving either way
+    uint64_t readMs;  // With no bytes from the client
+    uint64_t totalMs; // Since the session started
+};
+
+const SessionTimeouts NO_TIMEOUTS = {0, 0, 0};
+
+inline bool hasTimeouts(const SessionTimeouts &timeouts) {
+    return timeouts.idleMs > 0 || timeouts.readMs > 0 || timeouts.totalMs > 0;
+}
+
+// The three timeouts of one session on a wheel, kept by one timer set for
+// the earliest deadline. Traffic only records when it happened; a timer
+// that fires before any deadline has passed is put back for the next one,
+// so a busy session costs no timer operations. On expiry expired() is set
+// and the loop is stopped, or, for a session sharing its loop, the timer
+// is passed on to onExpiry instead.
+class SessionTimers : public TimerHandler {
+public:
+    SessionTimers(TimerWheel &wheel, EventLoop &loop, const SessionTimeouts &limits,
+                  TimerHandler *onExpiry = nullptr);
+
+    void start();
+    void stop();
+    void sawInput();    // Bytes from the client
+    void sawActivity(); // Bytes either way
+    bool expired() const { return expired_; }
+
+    void onTimer(Timer &timer) override;
+
+private:
+    // Milliseconds on the wheel's clock; UINT64_MAX with no limits set
+    uint64_t deadline() const;
+    void arm();
+
+    TimerWheel &wheel_;
+    EventLoop &loop_;
+    TimerHandler *onExpiry_;
+    SessionTimeouts limits_;
+    uint64_t started_;
+    uint64_t lastInput_;
+    uint64_t lastActivity_;
+    bool expired_;
+    Timer timer_;
+};
@@ -0,0 +1,264 @@
+#include "trace.hpp"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+const char *const PHASE_NAMES[TRACE_PHASES] = {"bind", "accept", "handoff", "fork", "resolve", "connect", "exec", "end"};
+const char *const DIRECTION_NAMES[TRACE_DIRECTIONS] = {"in", "out"};
+const size_t LINE_SIZE = 1024;
+
+// tcpi_state values; netinet/tcp.h has them but clashes with linux/tcp.h
+const uint8_t STATE_FIN_WAIT2 = 5;
+const uint8_t STATE_TIME_WAIT = 6;
+const uint8_t STATE_CLOSE_WAIT = 8;
+const uint8_t STATE_LAST_ACK = 9;
+const uint8_t STATE_CLOSING = 11;
+
+int sink = -1;
+bool datagrams = false; // sink is a Unix datagram socket
+ConnectionTrace current;
+int handBack = -1; // Write end of the pipe to the parent waiting in awaitExec()
+
+uint64_t clockNs(clockid_t clock) {
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void append(char *line, size_t size, size_t &used, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+void append(char *line, size_t size, size_t &used, const char *format, ...) {
+    if (used >= size) return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line + used, size - used, format, args);
+    va_end(args);
+    if (n > 0) used = used + n < size ? used + n : size;
+}
+
+// What the kernel counted on a TCP socket: bytes received, and bytes sent
+// and acknowledged
+bool tcpCounts(int socket, uint64_t &received, uint64_t &acked) {
+    tcp_info info;
+    memset(&info, 0, sizeof(info));
+    socklen_t length = sizeof(info);
+    if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &length) < 0) return false;
+    // Kernels before 4.1 stop short of the byte counts
+    if (length < offsetof(tcp_info, tcpi_bytes_received) + sizeof(info.tcpi_bytes_received)) return false;
+    received = info.tcpi_bytes_received;
+    acked = info.tcpi_bytes_acked;
+    // A FIN takes up a sequence number, which the kernel counts as a byte
+    uint8_t state = info.tcpi_state;
+    bool finReceived = state == STATE_CLOSE_WAIT || state == STATE_LAST_ACK || state == STATE_CLOSING ||
+                       state == STATE_TIME_WAIT;
+    bool finAcked = state == STATE_FIN_WAIT2 || state == STATE_TIME_WAIT;
+    if (finReceived && received > 0) --received;
+    if (finAcked && acked > 0) --acked;
+    return true;
+}
+
+} // namespace
+
+uint64_t traceClock() {
+    return clockNs(CLOCK_MONOTONIC);
+}
+
+void ConnectionTrace::accepted(int client, uint64_t at) {
+    begin(at);
+    phases_[TRACE_ACCEPT] = at;
+    setPeer(client);
+}
+
+void ConnectionTrace::begin(uint64_t at) {
+    *this = ConnectionTrace();
+    began_ = at;
+    wallClock_ = clockNs(CLOCK_REALTIME) - (traceClock() - at);
+}
+
+void ConnectionTrace::carried() {
+    counted_[TRACE_IN] = counted_[TRACE_OUT] = true;
+}
+
+void ConnectionTrace::moved(TraceDirection direction, size_t n) {
+    uint64_t now = traceClock();
+    if (first_[direction] == 0) first_[direction] = now;
+    last_[direction] = now;
+    bytes_[direction] += n;
+}
+
+void ConnectionTrace::countSockets(int in, int out) {
+    uint64_t received, acked;
+    if (in >= 0 && tcpCounts(in, received, acked)) {
+        bytes_[TRACE_IN] = received;
+        counted_[TRACE_IN] = true;
+    }
+    if (out >= 0 && (out == in ? counted_[TRACE_IN] : tcpCounts(out, received, acked))) {
+        bytes_[TRACE_OUT] = acked;
+        counted_[TRACE_OUT] = true;
+    }
+}
+
+void ConnectionTrace::merge(const ConnectionTrace &other) {
+    for (int phase = 0; phase < TRACE_PHASES; ++phase) {
+        if (phases_[phase] == 0) phases_[phase] = other.phases_[phase];
+    }
+}
+
+void ConnectionTrace::end(int status) {
+    status_ = status;
+    mark(TRACE_END);
+    if (sink < 0) return;
+    char line[LINE_SIZE];
+    size_t n = format(line, sizeof(line));
+    // A line that cannot be written is lost rather than holding anything up,
+    // and leaves errno as the caller had it
+    int saved = errno;
+    ssize_t written = datagrams ? send(sink, line, n, MSG_DONTWAIT | MSG_NOSIGNAL) : write(sink, line, n);
+    (void)written;
+    errno = saved;
+}
+
+void ConnectionTrace::setPeer(int client) {
+    peer_[0] = '\0';
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (getpeername(client, reinterpret_cast<sockaddr *>(&address), &length) < 0) return;
+    char host[INET6_ADDRSTRLEN];
+    if (address.ss_family == AF_INET) {
+        const sockaddr_in *in = reinterpret_cast<const sockaddr_in *>(&address);
+        if (inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host))) {
+            snprintf(peer_, sizeof(peer_), "%s:%u", host, ntohs(in->sin_port));
+        }
+    } else if (address.ss_family == AF_INET6) {
+        const sockaddr_in6 *in6 = reinterpret_cast<const sockaddr_in6 *>(&address);
+        if (inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host))) {
+            snprintf(peer_, sizeof(peer_), "[%s]:%u", host, ntohs(in6->sin6_port));
+        }
+    }
+}
+
+// Times are microseconds from began_, which is the accept where there was
+// one; phases not gone through are left out
+size_t ConnectionTrace::format(char *line, size_t size) const {
+    size_t used = 0;
+    append(line, size, used, "{\"time\":%llu.%06llu,\"pid\":%d", static_cast<unsigned long long>(wallClock_ / 1000000000),
+           static_cast<unsigned long long>(wallClock_ % 1000000000 / 1000), static_cast<int>(getpid()));
+    if (peer_[0] != '\0') append(line, size, used, ",\"peer\":\"%s\"", peer_);
+    for (int phase = 0; phase < TRACE_PHASES; ++phase) {
+        if (phases_[phase] == 0) continue;
+        long long us = (static_cast<long long>(phases_[phase]) - static_cast<long long>(began_)) / 1000;
+        append(line, size, used, ",\"%s_us\":%lld", PHASE_NAMES[phase], us);
+    }
+    for (int direction = 0; direction < TRACE_DIRECTIONS; ++direction) {
+        if (!counted_[direction]) continue;
+        append(line, size, used, ",\"%s\":{\"bytes\":%llu", DIRECTION_NAMES[direction],
+               static_cast<unsigned long long>(bytes_[direction]));
+        if (first_[direction] != 0) {
+            append(line, size, used, ",\"first_us\":%lld,\"last_us\":%lld",
+                   static_cast<long long>(first_[direction] - began_) / 1000,
+                   static_cast<long long>(last_[direction] - began_) / 1000);
+        }
+        append(line, size, used, "}");
+    }
+    if (status_ >= 0 && WIFEXITED(status_)) {
+        append(line, size, used, ",\"exit\":%d", WEXITSTATUS(status_));
+    } else if (status_ >= 0 && WIFSIGNALED(status_)) {
+        append(line, size, used, ",\"signal\":%d", WTERMSIG(status_));
+    }
+    append(line, size, used, "}\n");
+    return used;
+}
+
+bool openTrace(const std::string &target) {
+    int fd;
+    bool unixSocket = target.compare(0, 5, "unix:") == 0;
+    if (unixSocket) {
+        std::string path = target.substr(5);
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            errno = EINVAL;
+            return false;
+        }
+        memcpy(address.sun_path, path.data(), path.size());
+        fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+        if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return false;
+        }
+    } else {
+        // O_APPEND keeps the lines of every process whole
+        fd = open(target.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+    }
+    if (sink >= 0) close(sink);
+    sink = fd;
+    datagrams = unixSocket;
+    current.begin(traceClock());
+    return true;
+}
+
+bool tracing() {
+    return sink >= 0;
+}
+
+ConnectionTrace *processTrace() {
+    return sink >= 0 ? &current : nullptr;
+}
+
+void handBackAtExec(int fd) {
+    handBack = fd;
+}
+
+void traceExec() {
+    if (handBack < 0 || sink < 0) return;
+    ssize_t n = write(handBack, &current, sizeof(current));
+    (void)n; // The parent only goes without the child's stamps
+}
+
+void traceExecFailed() {
+    if (handBack < 0) return;
+    char byte = 0;
+    ssize_t n = write(handBack, &byte, 1);
+    (void)n;
+}
+
+void awaitExec(int fd) {
+    ConnectionTrace child;
+    char *into = reinterpret_cast<char *>(&child);
+    size_t got = 0;
+    while (got < sizeof(child)) {
+        ssize_t n = read(fd, into + got, sizeof(child) - got);
+        if (n > 0) {
+            got += n;
+        } else if (n == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    if (got < sizeof(child)) return; // The child gave up before exec
+    // The pipe closes at the exec; a byte first means it failed
+    char byte;
+    ssize_t n;
+    while ((n = read(fd, &byte, 1)) < 0 && errno == EINTR) {
+    }
+    current.merge(child);
+    if (n == 0) current.mark(TRACE_EXEC);
+}
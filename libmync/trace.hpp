@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Where a connection's time went. While tracing, each phase a connection
+// goes through is stamped as it completes, along with the byte count of
+// each direction and, where the traffic passes through mync, the times of
+// its first and last byte; the connection is written out as one JSON line
+// when it ends. Stamps are CLOCK_MONOTONIC, which is read without a system
+// call, and a line is a single write(), so tracing is cheap enough to
+// leave on.
+
+enum TracePhase {
+    TRACE_BIND,    // A one-shot mync is listening
+    TRACE_ACCEPT,  // The client is accepted
+    TRACE_HANDOFF, // The process or loop that serves it has the client
+    TRACE_FORK,    // The program's process is forked
+    TRACE_RESOLVE, // The -o host is looked up
+    TRACE_CONNECT, // The -o connection is up
+    TRACE_EXEC,    // The program is running
+    TRACE_END,     // The program has exited, or the session is over
+    TRACE_PHASES
+};
+
+// What the client sent, and what was sent back to it, or on to the -o
+// peer in a one-shot mync
+enum TraceDirection { TRACE_IN, TRACE_OUT, TRACE_DIRECTIONS };
+
+// Nanoseconds on the trace clock
+uint64_t traceClock();
+
+// One connection's stamps. Plain data, so that a forked process's copy can
+// be handed back whole.
+class ConnectionTrace {
+public:
+    // Starts over for client, accepted at the given time
+    void accepted(int client, uint64_t at);
+    // Starts over at the given time
+    void begin(uint64_t at);
+    // Records the client's address
+    void setPeer(int client);
+
+    void mark(TracePhase phase) { phases_[phase] = traceClock(); }
+    void mark(TracePhase phase, uint64_t at) { phases_[phase] = at; }
+    uint64_t began() const { return began_; }
+
+    // The traffic passes through mync, so both ways are counted from 0
+    void carried();
+    // n bytes have passed through mync one way
+    void moved(TraceDirection direction, size_t n);
+    // For traffic mync did not carry: the byte counts the kernel kept for
+    // the TCP sockets the program read from and wrote to, -1 for none
+    void countSockets(int in, int out);
+    // Takes the phases only other has stamped
+    void merge(const ConnectionTrace &other);
+
+    // Stamps TRACE_END and writes the line, leaving errno alone; status is
+    // the program's wait status, or -1 if no program ran
+    void end(int status = -1);
+
+private:
+    size_t format(char *line, size_t size) const;
+
+    uint64_t began_ = 0;
+    uint64_t wallClock_ = 0; // CLOCK_REALTIME nanoseconds at began_
+    uint64_t phases_[TRACE_PHASES] = {}; // 0 for phases not gone through
+    uint64_t first_[TRACE_DIRECTIONS] = {};
+    uint64_t last_[TRACE_DIRECTIONS] = {};
+    uint64_t bytes_[TRACE_DIRECTIONS] = {};
+    bool counted_[TRACE_DIRECTIONS] = {};
+    int status_ = -1;
+    char peer_[64] = {}; // "address:port", or empty
+};
+
+// Starts tracing: lines go to target, a file appended to, or unix:PATH, a
+// Unix datagram socket that gets a line per datagram and loses those it
+// has no room for rather than holding up a connection. Returns false with
+// errno set if it cannot be opened.
+bool openTrace(const std::string &target);
+bool tracing();
+
+// The connection this process serves, or last served, while tracing: a
+// one-shot mync's, or a client's in a process forked for it. Null when not
+// tracing.
+ConnectionTrace *processTrace();
+
+// Stamps taken in a forked child before it execs its program are its own.
+// The child is given the write end of a close-on-exec pipe and hands its
+// trace over in traceExec(), just before exec, and says so in
+// traceExecFailed() if the exec fails; the parent waits for the pipe to
+// close in awaitExec() and stamps TRACE_EXEC if the exec went through.
+void handBackAtExec(int fd);
+void traceExec();
+void traceExecFailed();
+void awaitExec(int fd);
@@ -0,0 +1,317 @@
+#include "uring.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t INDEX_BITS = 15;
+const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+const unsigned FILE_TABLE_MAX = 4096;
+
+template <typename T> T *at(void *base, unsigned offset) {
+    return reinterpret_cast<T *>(static_cast<char *>(base) + offset);
+}
+
+unsigned loadAcquire(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+void storeRelease(unsigned *p, unsigned value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+int setup(unsigned entries, io_uring_params &params) {
+    // Completions are only needed when the loop asks for them, which lets
+    // the kernel skip interrupting the task for each one
+    const unsigned preferred[] = {IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER |
+                                      IORING_SETUP_DEFER_TASKRUN,
+                                  IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN, 0};
+    for (unsigned flags : preferred) {
+        memset(&params, 0, sizeof(params));
+        params.flags = flags;
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd >= 0 || errno != EINVAL) return fd;
+    }
+    return -1;
+}
+
+} // namespace
+
+Uring::Uring(unsigned entries)
+    : fd_(-1), rings_(MAP_FAILED), ringsSize_(0), sqes_(nullptr), sqesSize_(0), sqHead_(nullptr), sqTail_(nullptr),
+      sqMask_(nullptr), sqArray_(nullptr), cqHead_(nullptr), cqTail_(nullptr), cqMask_(nullptr), cqes_(nullptr),
+      features_(0), sqEntries_(0), queued_(0), pending_(0), nextGroup_(0),
+      retired_(*this) {
+    io_uring_params params;
+    int fd = setup(entries, params);
+    if (fd < 0) return;
+    // Older kernels lack what the loop relies on: one mapping for both
+    // rings, no dropped completions and waits with a timeout
+    const unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & needed) != needed) {
+        close(fd);
+        return;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    ringsSize_ = sqSize > cqSize ? sqSize : cqSize;
+    rings_ = mmap(nullptr, ringsSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void *sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (rings_ == MAP_FAILED || sqes == MAP_FAILED) {
+        if (rings_ != MAP_FAILED) munmap(rings_, ringsSize_);
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize_);
+        rings_ = MAP_FAILED;
+        close(fd);
+        return;
+    }
+    sqes_ = static_cast<io_uring_sqe *>(sqes);
+    sqHead_ = at<unsigned>(rings_, params.sq_off.head);
+    sqTail_ = at<unsigned>(rings_, params.sq_off.tail);
+    sqMask_ = at<unsigned>(rings_, params.sq_off.ring_mask);
+    sqArray_ = at<unsigned>(rings_, params.sq_off.array);
+    cqHead_ = at<unsigned>(rings_, params.cq_off.head);
+    cqTail_ = at<unsigned>(rings_, params.cq_off.tail);
+    cqMask_ = at<unsigned>(rings_, params.cq_off.ring_mask);
+    cqes_ = at<io_uring_cqe>(rings_, params.cq_off.cqes);
+    features_ = params.features;
+    sqEntries_ = params.sq_entries;
+    // Entry i always sits in slot i
+    for (unsigned i = 0; i < sqEntries_; ++i) {
+        sqArray_[i] = i;
+    }
+    fd_ = fd;
+    retired_.handle_ = attach(&retired_);
+
+    std::vector<char> space(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(space.data());
+    supported_.assign(256, 0);
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        for (unsigned i = 0; i < probe->ops_len && i < 256; ++i) {
+            if (probe->ops[i].flags & IO_URING_OP_SUPPORTED) supported_[probe->ops[i].op] = 1;
+        }
+    }
+
+    // A sparse table sized to what the process may have open
+    rlimit limit;
+    unsigned files = FILE_TABLE_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < files) files = static_cast<unsigned>(limit.rlim_cur);
+    io_uring_rsrc_register table;
+    memset(&table, 0, sizeof(table));
+    table.nr = files;
+    table.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES2, &table, sizeof(table)) == 0) {
+        for (int slot = static_cast<int>(files) - 1; slot >= 0; --slot) {
+            freeFiles_.push_back(slot);
+        }
+    }
+}
+
+Uring::~Uring() {
+    if (fd_ < 0) return;
+    // Buffers still being removed are only unmapped once the kernel is done
+    // with them; other completions have no one left to take them
+    while (!retired_.mappings_.empty() && submitAndWait(-1) >= 0) {
+        io_uring_cqe cqe;
+        while (next(cqe)) {
+            if ((cqe.user_data & ((1ull << 40) - 1)) == userData(retired_.handle_, 0)) dispatch(cqe);
+        }
+    }
+    munmap(sqes_, sqesSize_);
+    munmap(rings_, ringsSize_);
+    close(fd_);
+}
+
+bool Uring::supports(int opcode) const {
+    return fd_ >= 0 && opcode >= 0 && opcode < 256 && supported_[opcode];
+}
+
+uint32_t Uring::attach(Completion *completion) {
+    uint32_t index;
+    if (!freeSlots_.empty()) {
+        index = freeSlots_.back();
+        freeSlots_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(slots_.size());
+        // Generations start at 1 so no handle's user_data is 0
+        slots_.push_back(Slot{nullptr, 1});
+    }
+    slots_[index].completion = completion;
+    return (static_cast<uint32_t>(slots_[index].generation) << INDEX_BITS) | index;
+}
+
+void Uring::detach(uint32_t handle) {
+    uint32_t index = handle & INDEX_MASK;
+    if (index >= slots_.size() || slots_[index].completion == nullptr) return;
+    slots_[index].completion = nullptr;
+    if (++slots_[index].generation == 0) slots_[index].generation = 1;
+    freeSlots_.push_back(index);
+}
+
+io_uring_sqe *Uring::prepare(int opcode, int fd, uint64_t userData) {
+    unsigned tail = *sqTail_ + queued_;
+    if (tail - loadAcquire(sqHead_) >= sqEntries_) {
+        submitAndWait(0);
+        tail = *sqTail_ + queued_;
+    }
+    io_uring_sqe *sqe = &sqes_[tail & *sqMask_];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = static_cast<uint8_t>(opcode);
+    sqe->fd = fd;
+    sqe->user_data = userData;
+    ++queued_;
+    if (userData != 0 && !(userData & 1)) ++pending_;
+    return sqe;
+}
+
+void Uring::cancel(uint64_t userData) {
+    io_uring_sqe *sqe = prepare(IORING_OP_ASYNC_CANCEL, -1, 0);
+    sqe->addr = userData;
+}
+
+void Uring::cancelFd(int fd, bool fixed) {
+    io_uring_sqe *sqe = prepare(IORING_OP_ASYNC_CANCEL, fd, 0);
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL | (fixed ? IORING_ASYNC_CANCEL_FD_FIXED : 0);
+}
+
+int Uring::enter(unsigned submit, unsigned wait, unsigned flags, const void *arg, size_t argSize) {
+    int n;
+    do {
+        n = static_cast<int>(syscall(__NR_io_uring_enter, fd_, submit, wait, flags, arg, argSize));
+    } while (n < 0 && errno == EINTR && wait == 0);
+    return n;
+}
+
+int Uring::submitAndWait(int timeoutMs) {
+    unsigned submit = queued_;
+    storeRelease(sqTail_, *sqTail_ + queued_);
+    queued_ = 0;
+
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    unsigned wait = timeoutMs == 0 ? 0 : 1;
+    if (timeoutMs > 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+    // GETEVENTS also runs completions the kernel deferred to this task
+    int n = enter(submit, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (n < 0 && (errno == ETIME || errno == EINTR)) return 0;
+    return n;
+}
+
+bool Uring::next(io_uring_cqe &cqe) {
+    unsigned head = *cqHead_;
+    if (head == loadAcquire(cqTail_)) return false;
+    cqe = cqes_[head & *cqMask_];
+    storeRelease(cqHead_, head + 1);
+    return true;
+}
+
+void Uring::dispatch(const io_uring_cqe &cqe) {
+    if (cqe.user_data == 0 || (cqe.user_data & 1)) return;
+    if (!(cqe.flags & IORING_CQE_F_MORE) && pending_ > 0) --pending_;
+    uint32_t handle = static_cast<uint32_t>((cqe.user_data >> 1) & 0x7fffffff);
+    uint32_t index = handle & INDEX_MASK;
+    if (index >= slots_.size()) return;
+    const Slot &slot = slots_[index];
+    if (slot.completion == nullptr || slot.generation != static_cast<uint16_t>(handle >> INDEX_BITS)) return;
+    slot.completion->onCompletion(static_cast<uint32_t>(cqe.user_data >> 40), cqe.res, cqe.flags);
+}
+
+int Uring::registerFile(int fd) {
+    if (freeFiles_.empty()) return -1;
+    int slot = freeFiles_.back();
+    io_uring_rsrc_update2 update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.data = reinterpret_cast<uint64_t>(&fd);
+    update.nr = 1;
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES_UPDATE2, &update, sizeof(update)) != 1) return -1;
+    freeFiles_.pop_back();
+    return slot;
+}
+
+void Uring::unregisterFile(int slot) {
+    if (slot < 0) return;
+    int none = -1;
+    io_uring_rsrc_update2 update;
+    memset(&update, 0, sizeof(update));
+    update.offset = slot;
+    update.data = reinterpret_cast<uint64_t>(&none);
+    update.nr = 1;
+    syscall(__NR_io_uring_register, fd_, IORING_REGISTER_FILES_UPDATE2, &update, sizeof(update));
+    freeFiles_.push_back(slot);
+}
+
+int Uring::newBufferGroup() {
+    if (!freeGroups_.empty()) {
+        uint16_t group = freeGroups_.back();
+        freeGroups_.pop_back();
+        return group;
+    }
+    if (nextGroup_ > UINT16_MAX) return -1;
+    return static_cast<int>(nextGroup_++);
+}
+
+void Uring::retireBuffers(uint16_t group, unsigned count, void *mapping, size_t size) {
+    io_uring_sqe *sqe = prepare(IORING_OP_REMOVE_BUFFERS, static_cast<int>(count), userData(retired_.handle_, group));
+    sqe->buf_group = group;
+    retired_.mappings_.push_back(Retired::Mapping{group, mapping, size});
+    submitAndWait(0);
+}
+
+void Uring::Retired::onCompletion(uint32_t tag, int result, uint32_t flags) {
+    (void)result;
+    (void)flags;
+    for (size_t i = 0; i < mappings_.size(); ++i) {
+        if (mappings_[i].group == tag) {
+            munmap(mappings_[i].base, mappings_[i].size);
+            uring_.freeGroups_.push_back(mappings_[i].group);
+            mappings_.erase(mappings_.begin() + i);
+            return;
+        }
+    }
+}
+
+BufferGroup::BufferGroup(Uring &uring, unsigned count, size_t size)
+    : uring_(uring), count_(count), size_(size), group_(0), mappingSize_(count * size), base_(nullptr) {
+    if (!uring_.supports(IORING_OP_PROVIDE_BUFFERS) || !uring_.supports(IORING_OP_REMOVE_BUFFERS)) return;
+    void *mapping = mmap(nullptr, mappingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return;
+    int group = uring_.newBufferGroup();
+    if (group < 0) {
+        munmap(mapping, mappingSize_);
+        return;
+    }
+    group_ = static_cast<uint16_t>(group);
+    base_ = static_cast<char *>(mapping);
+    provide(0, count_);
+}
+
+BufferGroup::~BufferGroup() {
+    if (base_) uring_.retireBuffers(group_, count_, base_, mappingSize_);
+}
+
+void BufferGroup::recycle(uint16_t id) {
+    provide(id, 1);
+}
+
+void BufferGroup::provide(uint16_t first, unsigned count) {
+    io_uring_sqe *sqe = uring_.prepare(IORING_OP_PROVIDE_BUFFERS, static_cast<int>(count), 0);
+    sqe->addr = reinterpret_cast<uint64_t>(buffer(first));
+    sqe->len = static_cast<uint32_t>(size_);
+    sqe->off = first;
+    sqe->buf_group = group_;
+    if (uring_.has(IORING_FEAT_CQE_SKIP)) sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+}
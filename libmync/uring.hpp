@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <vector>
+
+// Receives the results of operations submitted to a ring
+class Completion {
+public:
+    virtual ~Completion() {}
+    // tag is what the operation was submitted with; result is its return
+    // value or -errno; flags are the IORING_CQE_F_* bits
+    virtual void onCompletion(uint32_t tag, int result, uint32_t flags) = 0;
+};
+
+// An io_uring instance driven through the raw system calls. Handlers are
+// attached once and named in user_data by index and generation, so a
+// completion that arrives after its handler detached is dropped rather
+// than delivered to freed memory. user_data with the low bit set is left
+// to the caller (the event loop files its polls that way).
+class Uring {
+public:
+    explicit Uring(unsigned entries = 256);
+    ~Uring();
+
+    bool valid() const { return fd_ >= 0; }
+    bool supports(int opcode) const;
+    // IORING_FEAT_* bits
+    bool has(unsigned feature) const { return (features_ & feature) == feature; }
+
+    uint32_t attach(Completion *completion);
+    void detach(uint32_t handle);
+    static uint64_t userData(uint32_t handle, uint32_t tag) {
+        return (static_cast<uint64_t>(tag) << 40) | (static_cast<uint64_t>(handle) << 1);
+    }
+
+    // A zeroed entry for opcode on fd, queued for the next submit; the
+    // queue is submitted first if it is full
+    io_uring_sqe *prepare(int opcode, int fd, uint64_t userData);
+    // Cancels the operation submitted with userData, or every operation
+    // on fd (a fixed-file slot when fixed)
+    void cancel(uint64_t userData);
+    void cancelFd(int fd, bool fixed);
+
+    // Submits what is queued and waits up to timeoutMs (-1 forever, 0 not
+    // at all) for a completion; -1 with errno set on failure
+    int submitAndWait(int timeoutMs);
+    // Pops the next completion; false when there is none
+    bool next(io_uring_cqe &cqe);
+    // Hands a completion to its attached handler, if it still has one
+    void dispatch(const io_uring_cqe &cqe);
+    // Operations for attached handlers still to complete
+    size_t pending() const { return pending_; }
+
+    // Fixed files: a slot in the ring's table for fd, or -1 when the table
+    // is full or registration is refused
+    int registerFile(int fd);
+    void unregisterFile(int slot);
+
+    // Provided-buffer group ids. A group's id is only given out again once
+    // retireBuffers() has seen its buffers removed, so buffers a group
+    // leaves behind cannot be picked for anyone else. -1 once all 65536
+    // ids are in use.
+    int newBufferGroup();
+    // Queues the removal of what is left of group and submits it at once;
+    // the mapping holding its buffers is unmapped, and the id freed, when
+    // the removal completes, or when the ring is closed
+    void retireBuffers(uint16_t group, unsigned count, void *mapping, size_t size);
+
+    int fd() const { return fd_; }
+
+private:
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    int enter(unsigned submit, unsigned wait, unsigned flags, const void *arg, size_t argSize);
+
+    // Buffers whose removal has been submitted but has not completed
+    class Retired : public Completion {
+    public:
+        explicit Retired(Uring &uring) : uring_(uring), handle_(0) {}
+        void onCompletion(uint32_t tag, int result, uint32_t flags) override;
+
+        struct Mapping {
+            uint16_t group;
+            void *base;
+            size_t size;
+        };
+
+        Uring &uring_;
+        uint32_t handle_;
+        std::vector<Mapping> mappings_;
+    };
+
+    struct Slot {
+        Completion *completion;
+        uint16_t generation;
+    };
+
+    int fd_;
+    void *rings_;
+    size_t ringsSize_;
+    io_uring_sqe *sqes_;
+    size_t sqesSize_;
+    unsigned *sqHead_, *sqTail_, *sqMask_, *sqArray_;
+    unsigned *cqHead_, *cqTail_, *cqMask_;
+    io_uring_cqe *cqes_;
+    unsigned features_;
+    unsigned sqEntries_;
+    unsigned queued_;
+    size_t pending_;
+    std::vector<uint8_t> supported_;
+    std::vector<Slot> slots_;
+    std::vector<uint32_t> freeSlots_;
+    std::vector<int> freeFiles_;
+    uint32_t nextGroup_; // Ids below this have been given out
+    std::vector<uint16_t> freeGroups_;
+    Retired retired_;
+};
+
+// Equal-sized buffers handed to the kernel for receives with
+// IOSQE_BUFFER_SELECT to pick from, and handed back with recycle(). They
+// are provided with IORING_OP_PROVIDE_BUFFERS, which queues an entry for
+// the next submission rather than making a call of its own.
+class BufferGroup {
+public:
+    BufferGroup(Uring &uring, unsigned count, size_t size);
+    ~BufferGroup();
+
+    bool valid() const { return base_ != nullptr; }
+    uint16_t group() const { return group_; }
+    char *buffer(uint16_t id) const { return base_ + static_cast<size_t>(id) * size_; }
+    void recycle(uint16_t id);
+
+private:
+    BufferGroup(const BufferGroup &) = delete;
+    BufferGroup &operator=(const BufferGroup &) = delete;
+
+    void provide(uint16_t first, unsigned count);
+
+    Uring &uring_;
+    unsigned count_;
+    size_t size_;
+    uint16_t group_;
+    size_t mappingSize_;
+    char *base_;
+};
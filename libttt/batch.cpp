@@ -0,0 +1,200 @@
+#include "batch.hpp"
+#include "session.hpp"
+#include "ttt.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const size_t CHUNK_BYTES = 1 << 20;
+
+// The whole input, mmap'd when it is a regular file
+class Input {
+public:
+    Input() : data_(nullptr), size_(0), mapped_(false) {}
+    ~Input() {
+        if (mapped_) munmap(const_cast<char *>(data_), size_);
+    }
+
+    bool open(const char *path) {
+        int fd = path ? ::open(path, O_RDONLY) : STDIN_FILENO;
+        if (fd < 0) return false;
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = map != MAP_FAILED;
+            if (ok) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                data_ = static_cast<const char *>(map);
+                size_ = st.st_size;
+                mapped_ = true;
+            }
+        } else if (ok) {
+            char buffer[1 << 16];
+            ssize_t n;
+            while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+                owned_.insert(owned_.end(), buffer, buffer + n);
+            }
+            ok = n == 0;
+            data_ = owned_.data();
+            size_ = owned_.size();
+        }
+        if (path) close(fd);
+        return ok;
+    }
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char *data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<char> owned_;
+};
+
+// Plays one game line and appends its result line to out
+void scoreGame(GameSession &session, std::string &strategy, const char *line, const char *end, std::string &out) {
+    while (line < end && (*line == ' ' || *line == '\t' || *line == '\r')) ++line;
+    const char *token = line;
+    while (line < end && *line != ' ' && *line != '\t' && *line != '\r') ++line;
+
+    // Consecutive games usually share a strategy, so only recompile on change
+    bool ok;
+    if (strategy.size() == static_cast<size_t>(line - token) && strategy.compare(0, strategy.size(), token, line - token) == 0) {
+        ok = !strategy.empty() && session.start();
+    } else {
+        strategy.assign(token, line);
+        if (strategy == "--perfect") {
+            session.startPerfect();
+            ok = true;
+        } else {
+            ok = session.start(strategy);
+        }
+        if (!ok) strategy.clear();
+    }
+
+    size_t result = out.size();
+    out += "? ";
+    if (!ok) {
+        out[result] = 'E';
+        out += '\n';
+        return;
+    }
+
+    out += static_cast<char>('1' + session.programMove());
+    for (; line < end && ok; ++line) {
+        char c = *line;
+        if (c == ' ' || c == '\t' || c == ',' || c == '\r') continue;
+        if (session.state() != GAME_IN_PROGRESS || !session.playerMove(c - '1')) {
+            ok = false;
+        } else if (session.state() == GAME_IN_PROGRESS) {
+            out += static_cast<char>('1' + session.programMove());
+        }
+    }
+
+    if (!ok) {
+        out[result] = 'E';
+    } else if (session.state() == GAME_PROGRAM_WON) {
+        out[result] = 'W';
+    } else if (session.state() == GAME_PLAYER_WON) {
+        out[result] = 'L';
+    } else if (session.state() == GAME_DRAW) {
+        out[result] = 'D';
+    }
+    out += '\n';
+}
+
+struct Chunk {
+    const char *begin;
+    const char *end;
+    std::string out;
+    bool done;
+};
+
+bool writeAll(const std::string &text) {
+    size_t sent = 0;
+    while (sent < text.size()) {
+        ssize_t n = write(STDOUT_FILENO, text.data() + sent, text.size() - sent);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+} // namespace
+
+int runBatch(const char *path, unsigned threads) {
+    Input input;
+    if (!input.open(path)) {
+        printErrorAndExit();
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Cut the input into roughly equal chunks that end on a line boundary
+    std::vector<Chunk> chunks;
+    const char *data = input.data(), *end = data + input.size();
+    for (const char *begin = data; begin < end;) {
+        const char *cut = begin + std::min(CHUNK_BYTES, static_cast<size_t>(end - begin));
+        const char *newline = cut < end ? static_cast<const char *>(memchr(cut, '\n', end - cut)) : nullptr;
+        cut = newline ? newline + 1 : end;
+        chunks.push_back({begin, cut, std::string(), false});
+        begin = cut;
+    }
+
+    // Workers claim chunks in order; this thread writes them out in order
+    std::atomic<size_t> next(0);
+    std::mutex mutex;
+    std::condition_variable finished;
+    auto worker = [&]() {
+        GameSession session;
+        std::string strategy;
+        for (size_t i; (i = next++) < chunks.size();) {
+            Chunk &chunk = chunks[i];
+            std::string out;
+            out.reserve((chunk.end - chunk.begin) / 2);
+            for (const char *line = chunk.begin; line < chunk.end;) {
+                const char *newline = static_cast<const char *>(memchr(line, '\n', chunk.end - line));
+                const char *lineEnd = newline ? newline : chunk.end;
+                scoreGame(session, strategy, line, lineEnd, out);
+                line = lineEnd + 1;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            chunk.out.swap(out);
+            chunk.done = true;
+            finished.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back(worker);
+    }
+    bool ok = true;
+    for (Chunk &chunk : chunks) {
+        std::string out;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&chunk]() { return chunk.done; });
+            out.swap(chunk.out);
+        }
+        ok = ok && writeAll(out);
+    }
+    for (std::thread &t : workers) {
+        t.join();
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+// Scores archived games in bulk. Each input line is one game:
+//   <strategy|--perfect> <player moves>    e.g. "519372846 5 3 7" or "--perfect 537"
+// and produces one output line, in input order:
+//   <result> <program moves>    result is W (program won), L (program lost),
+//   D (draw), ? (moves ran out first) or E (bad strategy or illegal move)
+// Input is the file at path, or stdin when path is null; regular files are
+// mmap'd; input that cannot be read is an error, as for the other modes.
+// Work is spread over threads (0 means one per core).
+int runBatch(const char *path, unsigned threads);
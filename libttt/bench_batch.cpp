@@ -0,0 +1,71 @@
+#include "ttt.hpp"
+#include <chrono>
+#include <random>
+#include <vector>
+
+static double seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    size_t blocks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 32768;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 20;
+    // An explicit backend, such as sse2 on an AVX2 machine
+    if (blocks == 0 || rounds <= 0 || (argc > 3 && !useWinBatchBackend(argv[3]))) {
+        std::cerr << "usage: bench_batch [blocks] [rounds] [avx2|sse2|scalar]\n";
+        return 1;
+    }
+
+    // Random mid-game positions, so roughly a third of them hold a line
+    std::mt19937 rng(12345);
+    std::vector<BoardBatch> batch(blocks);
+    std::vector<Board> boards(blocks * BATCH_BOARDS);
+    for (size_t i = 0; i < boards.size(); ++i) {
+        Board board = {0, 0};
+        int marks = 3 + rng() % 7;
+        for (int m = 0; m < marks; ++m) {
+            int slot;
+            do {
+                slot = rng() % 9;
+            } while (!isEmpty(board, slot));
+            placeMark(board, slot, (m % 2) ? 'O' : 'X');
+        }
+        boards[i] = board;
+        batch[i / BATCH_BOARDS].x[i % BATCH_BOARDS] = board.x;
+        batch[i / BATCH_BOARDS].o[i % BATCH_BOARDS] = board.o;
+    }
+
+    std::vector<uint32_t> xWins(blocks), oWins(blocks);
+    std::vector<uint32_t> xScalar(blocks), oScalar(blocks);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < boards.size(); ++i) {
+            uint32_t bit = 1u << (i % BATCH_BOARDS);
+            if (i % BATCH_BOARDS == 0) {
+                xScalar[i / BATCH_BOARDS] = oScalar[i / BATCH_BOARDS] = 0;
+            }
+            if (isWinning(boards[i].x)) xScalar[i / BATCH_BOARDS] |= bit;
+            if (isWinning(boards[i].o)) oScalar[i / BATCH_BOARDS] |= bit;
+        }
+    }
+    double scalar = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        checkWinBatch(batch.data(), blocks, xWins.data(), oWins.data());
+    }
+    double batched = seconds(start);
+
+    if (xWins != xScalar || oWins != oScalar) {
+        std::cerr << "Mismatch between batch and scalar results\n";
+        return 1;
+    }
+
+    double evaluated = static_cast<double>(boards.size()) * rounds;
+    std::cout << "boards " << boards.size() << " x " << rounds << " rounds, batch backend "
+              << checkWinBatchBackend() << "\n";
+    std::cout << "scalar: " << evaluated / scalar / 1e6 << " M boards/s\n";
+    std::cout << "batch:  " << evaluated / batched / 1e6 << " M boards/s (" << scalar / batched << "x)\n";
+    return 0;
+}
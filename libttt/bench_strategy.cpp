@@ -0,0 +1,85 @@
+#include "ttt.hpp"
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Move selection as ttt did it before the strategy table: scan the strategy
+// string against the board, and scan it again when one cell is left.
+static int scanStrategy(const std::string &strategy, const Board &board) {
+    int programMove = -1;
+    for (char c : strategy) {
+        int slot = c - '1';
+        if (isEmpty(board, slot)) {
+            programMove = slot;
+            break;
+        }
+    }
+    if (__builtin_popcount(emptyCells(board)) == 1) {
+        for (char c : strategy) {
+            int slot = c - '1';
+            if (isEmpty(board, slot)) {
+                programMove = slot;
+                break;
+            }
+        }
+    }
+    return programMove;
+}
+
+template <typename Pick>
+static double nsPerMove(const std::vector<Board> &boards, int rounds, Pick pick, long &sink) {
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        for (const Board &board : boards) {
+            sink += pick(board);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / (static_cast<double>(rounds) * boards.size());
+}
+
+int main(int argc, char *argv[]) {
+    std::string strategy = argc > 1 ? argv[1] : "987654321";
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 2000;
+    if (strategy.size() != 9 || rounds <= 0) {
+        std::cerr << "usage: bench_strategy [strategy] [rounds]\n";
+        return 1;
+    }
+
+    // Random reachable-looking positions with at least one empty cell
+    std::mt19937 rng(12345);
+    std::vector<Board> boards;
+    while (boards.size() < 4096) {
+        Board board = {0, 0};
+        int marks = rng() % 9;
+        for (int i = 0; i < marks; ++i) {
+            int slot;
+            do {
+                slot = rng() % 9;
+            } while (!isEmpty(board, slot));
+            placeMark(board, slot, (i % 2) ? 'O' : 'X');
+        }
+        boards.push_back(board);
+    }
+
+    StrategyTable moves;
+    compileStrategy(strategy, moves);
+
+    long sink = 0;
+    double scan = nsPerMove(boards, rounds, [&](const Board &b) { return scanStrategy(strategy, b); }, sink);
+    double table = nsPerMove(boards, rounds, [&](const Board &b) { return pickMove(moves, b); }, sink);
+
+    for (const Board &board : boards) {
+        if (scanStrategy(strategy, board) != pickMove(moves, board)) {
+            std::cerr << "Mismatch between scan and table\n";
+            return 1;
+        }
+    }
+
+    std::cout << "strategy " << strategy << ", " << boards.size() * static_cast<long>(rounds) << " moves\n";
+    std::cout << "scan:  " << scan << " ns/move\n";
+    std::cout << "table: " << table << " ns/move (" << scan / table << "x)\n";
+    std::cout << "checksum " << sink << "\n";
+    return 0;
+}
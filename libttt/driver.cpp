@@ -0,0 +1,89 @@
+#include "driver.hpp"
+#include "ttt.hpp"
+#include "session.hpp"
+#include "tournament.hpp"
+#include "protocol.hpp"
+#include "grid.hpp"
+#include "batch.hpp"
+
+#include <unistd.h>
+
+int runTtt(int argc, char *argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "--tournament") {
+        unsigned threads = 0;
+        if (argc > 3 || (argc == 3 && !parseThreads(argv[2], threads))) {
+            printErrorAndExit();
+        }
+        return runTournament(threads);
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--batch") {
+        if (argc > 3) {
+            printErrorAndExit();
+        }
+        return runBatch(argc == 3 ? argv[2] : nullptr, 0);
+    }
+
+    if (argc >= 2 && std::string(argv[1]) == "--grid") {
+        if (argc != 4 || !runGrid(argv[2], argv[3])) {
+            printErrorAndExit();
+        }
+        return 0;
+    }
+
+    bool machine = argc >= 2 && std::string(argv[1]) == "--machine";
+    if (machine) {
+        --argc;
+        ++argv;
+    }
+
+    if (argc != 2) {
+        printErrorAndExit();
+    }
+
+    GameSession session;
+    if (std::string(argv[1]) == "--perfect") {
+        session.startPerfect();
+    } else if (!session.start(argv[1])) {
+        printErrorAndExit();
+    }
+
+    if (machine) {
+        return playMachine(session, STDIN_FILENO, STDOUT_FILENO);
+    }
+
+    while (true) {
+        printBoard(session.board());
+        // Program's turn
+        int programMove = session.programMove();
+        std::cout << programMove + 1 << "\n";
+        if (session.state() == GAME_PROGRAM_WON) {
+            printBoard(session.board());
+            std::cout << "I win\n";
+            break;
+        }
+        if (session.state() == GAME_DRAW) {
+            printBoard(session.board());
+            std::cout << "DRAW\n";
+            break;
+        }
+
+        // Player's turn
+        int playerMove = 0;
+        std::cin >> playerMove;
+        if (!session.playerMove(playerMove - 1)) { // Adjust for 0-based index
+            printErrorAndExit();
+        }
+        if (session.state() == GAME_PLAYER_WON) {
+            printBoard(session.board());
+            std::cout << "I lost\n";
+            break;
+        }
+        if (session.state() == GAME_DRAW) {
+            std::cout << "DRAW\n";
+            break;
+        }
+    }
+
+    return 0;
+}
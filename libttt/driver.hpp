@@ -0,0 +1,10 @@
+#pragma once
+
+// The ttt command line, shared by every qst build:
+//   ttt <strategy|--perfect>             plays one game on the terminal
+//   ttt --machine <strategy|--perfect>   plays one game over the machine protocol
+//   ttt --tournament [threads]           ranks every strategy
+//   ttt --batch [path]                   scores archived games
+//   ttt --grid <shape> <strategy>        plays on a larger board, e.g. "4x4/4"
+// Returns the exit status; bad arguments print Error and exit.
+int runTtt(int argc, char *argv[]);
@@ -0,0 +1,77 @@
+#include "grid.hpp"
+
+#include <iostream>
+
+namespace {
+
+template <typename Game>
+void printGrid(const Game &game) {
+    for (int row = 0; row < Game::SIZE; ++row) {
+        for (int col = 0; col < Game::SIZE; ++col) {
+            std::cout << (col ? " | " : " ") << game.cellAt(row * Game::SIZE + col);
+        }
+        std::cout << "\n";
+        if (row < Game::SIZE - 1) {
+            for (int col = 0; col < Game::SIZE; ++col) {
+                std::cout << (col ? "|---" : "---");
+            }
+            std::cout << "\n";
+        }
+    }
+}
+
+template <int N, int K>
+bool playGrid(const std::string &strategy) {
+    typedef GridGame<N, K> Game;
+    GridStrategy<Game::CELLS> moves;
+    if (!moves.compile(strategy)) {
+        return false;
+    }
+
+    Game game;
+    while (true) {
+        printGrid(game);
+        // Program's turn
+        int programMove = moves.pick(game);
+        bool won = game.play(programMove, 'X');
+        std::cout << programMove + 1 << "\n";
+        if (won) {
+            printGrid(game);
+            std::cout << "I win\n";
+            return true;
+        }
+        if (game.isFull()) {
+            printGrid(game);
+            std::cout << "DRAW\n";
+            return true;
+        }
+
+        // Player's turn
+        int playerMove;
+        if (!(std::cin >> playerMove)) {
+            return false;
+        }
+        --playerMove; // Adjust for 0-based index
+        if (playerMove < 0 || playerMove >= Game::CELLS || !game.isEmpty(playerMove)) {
+            return false;
+        }
+        if (game.play(playerMove, 'O')) {
+            printGrid(game);
+            std::cout << "I lost\n";
+            return true;
+        }
+        if (game.isFull()) {
+            std::cout << "DRAW\n";
+            return true;
+        }
+    }
+}
+
+} // namespace
+
+bool runGrid(const std::string &shape, const std::string &strategy) {
+    if (shape == "3x3/3") return playGrid<3, 3>(strategy);
+    if (shape == "4x4/4") return playGrid<4, 4>(strategy);
+    if (shape == "15x15/5") return playGrid<15, 5>(strategy);
+    return false;
+}
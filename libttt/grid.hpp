@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string>
+
+// N x N board where K in a row wins; only the lines through the last move
+// are examined, so a move costs O(K) whatever the board size.
+template <int N, int K>
+class GridGame {
+public:
+    static const int SIZE = N;
+    static const int CELLS = N * N;
+
+    GridGame() : filled_(0) {
+        for (int i = 0; i < CELLS; ++i) {
+            cells_[i] = ' ';
+        }
+    }
+
+    char cellAt(int slot) const { return cells_[slot]; }
+    bool isEmpty(int slot) const { return cells_[slot] == ' '; }
+    bool isFull() const { return filled_ == CELLS; }
+
+    // Places player's mark and reports whether it completes a run of K
+    bool play(int slot, char player) {
+        cells_[slot] = player;
+        ++filled_;
+        int row = slot / N, col = slot % N;
+        return runThrough(row, col, 0, 1, player) >= K ||
+               runThrough(row, col, 1, 0, player) >= K ||
+               runThrough(row, col, 1, 1, player) >= K ||
+               runThrough(row, col, 1, -1, player) >= K;
+    }
+
+private:
+    int runThrough(int row, int col, int dr, int dc, char player) const {
+        int run = 1;
+        for (int r = row + dr, c = col + dc, steps = 1; steps < K && inside(r, c) && cells_[r * N + c] == player;
+             r += dr, c += dc, ++steps) {
+            ++run;
+        }
+        for (int r = row - dr, c = col - dc, steps = 1; steps < K && inside(r, c) && cells_[r * N + c] == player;
+             r -= dr, c -= dc, ++steps) {
+            ++run;
+        }
+        return run;
+    }
+
+    static bool inside(int r, int c) { return r >= 0 && r < N && c >= 0 && c < N; }
+
+    char cells_[CELLS];
+    int filled_;
+};
+
+// Fixed priority order over the cells of a CELLS-cell board. Cells only ever
+// fill up, so a cursor that skips taken cells makes picks amortised O(1).
+template <int CELLS>
+class GridStrategy {
+public:
+    // Accepts a digit string such as "519372846" when CELLS <= 9, or a
+    // comma-separated list of distinct 1-based cells. Unlisted cells follow
+    // in ascending order.
+    bool compile(const std::string &strategy) {
+        bool listed[CELLS] = {};
+        int count = 0;
+        bool digits = CELLS <= 9 && strategy.find(',') == std::string::npos;
+        size_t pos = 0;
+        while (pos < strategy.size()) {
+            int cell = 0;
+            size_t end = pos;
+            if (digits) {
+                cell = strategy[pos] - '0';
+                end = pos + 1;
+                if (strategy[pos] < '0' || strategy[pos] > '9') return false;
+            } else {
+                while (end < strategy.size() && strategy[end] >= '0' && strategy[end] <= '9' && cell <= CELLS) {
+                    cell = cell * 10 + (strategy[end] - '0');
+                    ++end;
+                }
+                if (end == pos || (end < strategy.size() && strategy[end] != ',')) return false;
+                if (end < strategy.size()) ++end; // Skip the comma
+            }
+            if (cell < 1 || cell > CELLS || listed[cell - 1]) return false;
+            listed[cell - 1] = true;
+            order_[count++] = cell - 1;
+            pos = end;
+        }
+        if (count == 0) return false;
+        for (int cell = 0; cell < CELLS; ++cell) {
+            if (!listed[cell]) order_[count++] = cell;
+        }
+        cursor_ = 0;
+        return true;
+    }
+
+    template <typename Game>
+    int pick(const Game &game) {
+        while (!game.isEmpty(order_[cursor_])) {
+            ++cursor_;
+        }
+        return order_[cursor_];
+    }
+
+private:
+    int order_[CELLS];
+    int cursor_;
+};
+
+// Plays an interactive game on one of the supported shapes ("3x3/3",
+// "4x4/4", "15x15/5"); returns false if the shape or strategy is rejected.
+bool runGrid(const std::string &shape, const std::string &strategy);
@@ -0,0 +1,73 @@
+#include "perfect.hpp"
+
+namespace {
+
+const int8_t UNSOLVED = -128;
+
+// Scores a position for the side to move: positive wins, negative loses,
+// and quicker wins (or slower losses) score further from zero.
+int8_t solve(PerfectTable &table, int8_t scores[], Board board) {
+    int index = table.ternary[board.x] + 2 * table.ternary[board.o];
+    if (scores[index] != UNSOLVED) {
+        return scores[index];
+    }
+
+    // X always moves first, so equal counts mean it is X's turn
+    bool xToMove = __builtin_popcount(board.x) == __builtin_popcount(board.o);
+    uint16_t mover = xToMove ? board.x : board.o;
+    uint16_t opponent = xToMove ? board.o : board.x;
+    int8_t best;
+    int move = NO_MOVE;
+
+    if (isWinning(opponent)) {
+        best = static_cast<int8_t>(-1 - __builtin_popcount(emptyCells(board)));
+    } else if (isFull(board)) {
+        best = 0;
+    } else {
+        best = -127;
+        for (uint16_t free = emptyCells(board); free; free &= free - 1) {
+            Board next = board;
+            if (xToMove) {
+                next.x = mover | (free & -free);
+            } else {
+                next.o = mover | (free & -free);
+            }
+            int8_t score = static_cast<int8_t>(-solve(table, scores, next));
+            if (score > best) {
+                best = score;
+                move = __builtin_ctz(free);
+            }
+        }
+    }
+
+    table.moves[index] = static_cast<uint8_t>(move);
+    scores[index] = best;
+    return best;
+}
+
+} // namespace
+
+void solvePerfect(PerfectTable &table) {
+    for (int mask = 0; mask <= FULL_BOARD; ++mask) {
+        int code = 0;
+        for (int slot = 8; slot >= 0; --slot) {
+            code = code * 3 + ((mask >> slot) & 1);
+        }
+        table.ternary[mask] = static_cast<uint16_t>(code);
+    }
+
+    int8_t scores[POSITION_COUNT];
+    for (int i = 0; i < POSITION_COUNT; ++i) {
+        scores[i] = UNSOLVED;
+        table.moves[i] = NO_MOVE;
+    }
+    Board empty = {0, 0};
+    solve(table, scores, empty);
+}
+
+const PerfectTable &sharedPerfectTable() {
+    static PerfectTable table;
+    static bool solved = (solvePerfect(table), true);
+    (void)solved;
+    return table;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "ttt.hpp"
+
+const int POSITION_COUNT = 19683; // 3^9
+
+// Minimax-best move for the side to move in every reachable position,
+// indexed by the position's base-3 code
+struct PerfectTable {
+    uint16_t ternary[512]; // Base-3 code of one occupancy mask
+    uint8_t moves[POSITION_COUNT]; // 0-based slot, or NO_MOVE when the game is over
+};
+
+void solvePerfect(PerfectTable &table);
+// Process-wide table, solved on first use
+const PerfectTable &sharedPerfectTable();
+
+inline int perfectMove(const PerfectTable &table, const Board &board) {
+    return table.moves[table.ternary[board.x] + 2 * table.ternary[board.o]];
+}
@@ -0,0 +1,150 @@
+#include "protocol.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+LineReader::LineReader(int fd) : fd_(fd), begin_(0), end_(0) {}
+
+bool LineReader::next(const char *&line, size_t &length) {
+    while (true) {
+        const char *start = buffer_ + begin_;
+        const char *newline = static_cast<const char *>(memchr(start, '\n', end_ - begin_));
+        if (newline) {
+            line = start;
+            length = newline - start;
+            begin_ += length + 1;
+            if (length > 0 && line[length - 1] == '\r') {
+                --length;
+            }
+            return true;
+        }
+
+        // Compact the partial line to the front, then refill behind it
+        if (begin_ > 0) {
+            memmove(buffer_, buffer_ + begin_, end_ - begin_);
+            end_ -= begin_;
+            begin_ = 0;
+        }
+        if (end_ == sizeof(buffer_)) {
+            // Overlong line: hand it over whole, it will not parse as a move
+            line = buffer_;
+            length = end_;
+            begin_ = end_ = 0;
+            return true;
+        }
+
+        ssize_t n = read(fd_, buffer_ + end_, sizeof(buffer_) - end_);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // A final line without a newline still counts
+            if (end_ > begin_) {
+                line = buffer_ + begin_;
+                length = end_ - begin_;
+                begin_ = end_;
+                return true;
+            }
+            return false;
+        }
+        end_ += n;
+    }
+}
+
+TurnBuffer::TurnBuffer() : size_(0) {}
+
+void TurnBuffer::appendLine(char c) {
+    append(c);
+    append('\n');
+}
+
+void TurnBuffer::appendBoard(const Board &board) {
+    append('B');
+    append(' ');
+    for (int slot = 0; slot < 9; ++slot) {
+        if ((board.x >> slot) & 1) {
+            append('X');
+        } else if ((board.o >> slot) & 1) {
+            append('O');
+        } else {
+            append('.');
+        }
+    }
+    append('\n');
+}
+
+void TurnBuffer::flush(int fd) {
+    size_t sent = 0;
+    while (sent < size_) {
+        ssize_t n = write(fd, data_ + sent, size_ - sent);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    size_ = 0;
+}
+
+void formatBoardLine(const Board &board, std::string &out) {
+    TurnBuffer line;
+    line.appendBoard(board);
+    line.appendTo(out);
+}
+
+void TurnBuffer::appendTo(std::string &out) {
+    out.append(data_, size_);
+    size_ = 0;
+}
+
+int parseMove(const char *line, size_t length) {
+    if (length != 1 || line[0] < '1' || line[0] > '9') {
+        return -1;
+    }
+    return line[0] - '1';
+}
+
+int playMachine(GameSession &session, int in_fd, int out_fd) {
+    LineReader reader(in_fd);
+    TurnBuffer out;
+
+    while (true) {
+        // Program's turn
+        int programMove = session.programMove();
+        out.appendLine(static_cast<char>('1' + programMove));
+        if (session.state() != GAME_IN_PROGRESS) {
+            out.appendLine(session.state() == GAME_PROGRAM_WON ? 'W' : 'D');
+            out.flush(out_fd);
+            return 0;
+        }
+        out.flush(out_fd);
+
+        // Player's turn, answering board requests while we wait
+        const char *line;
+        size_t length;
+        while (true) {
+            if (!reader.next(line, length)) {
+                return 1;
+            }
+            if (length == 1 && (line[0] == 'B' || line[0] == 'b')) {
+                out.appendBoard(session.board());
+                out.flush(out_fd);
+                continue;
+            }
+            if (!session.playerMove(parseMove(line, length))) {
+                out.appendLine('E');
+                out.flush(out_fd);
+                return 1;
+            }
+            break;
+        }
+        if (session.state() != GAME_IN_PROGRESS) {
+            out.appendLine(session.state() == GAME_PLAYER_WON ? 'L' : 'D');
+            out.flush(out_fd);
+            return 0;
+        }
+    }
+}
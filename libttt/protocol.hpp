@@ -0,0 +1,56 @@
+#pragma once
+
+#include "ttt.hpp"
+#include "session.hpp"
+
+#include <cstddef>
+#include <string>
+
+// Machine protocol, one line per message:
+//   program -> peer  "<slot>"  program's move (1-9)
+//                    "W" / "L" / "D"  program won / lost / draw, then exits
+//                    "B <cells>"  board on request, 9 of 'X', 'O' or '.'
+//                    "E"  invalid input, then exits with status 1
+//   peer -> program  "<slot>"  player's move, or "B" to ask for the board
+// Everything the program says in one turn goes out in a single write().
+
+// Buffered line reader over a raw file descriptor
+class LineReader {
+public:
+    explicit LineReader(int fd);
+
+    // Next line without its line ending; false at end of input
+    bool next(const char *&line, size_t &length);
+
+private:
+    int fd_;
+    char buffer_[4096];
+    size_t begin_;
+    size_t end_;
+};
+
+// One turn's worth of output, sent with a single write()
+class TurnBuffer {
+public:
+    TurnBuffer();
+
+    void append(char c) { data_[size_++] = c; }
+    void appendLine(char c);
+    void appendBoard(const Board &board);
+    void flush(int fd);
+    // Hands the turn to out instead of writing it
+    void appendTo(std::string &out);
+
+private:
+    char data_[64];
+    size_t size_;
+};
+
+// Appends the board line appendBoard() writes, for output kept in a string
+void formatBoardLine(const Board &board, std::string &out);
+
+// Parses a player move line into a 0-based slot, or -1 for anything else
+int parseMove(const char *line, size_t length);
+
+// Plays one game over the machine protocol, session already started
+int playMachine(GameSession &session, int in_fd, int out_fd);
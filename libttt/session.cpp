@@ -0,0 +1,63 @@
+#include "session.hpp"
+
+GameSession::GameSession()
+    : board_(), state_(GAME_IN_PROGRESS), owned_(false), moves_(nullptr), perfect_(nullptr) {}
+
+GameSession::~GameSession() {
+    if (owned_) delete moves_;
+}
+
+bool GameSession::start(const std::string &strategy) {
+    if (!isValidStrategy(strategy)) return false;
+    StrategyTable *compiled = owned_ ? const_cast<StrategyTable *>(moves_) : new StrategyTable();
+    compileStrategy(strategy, *compiled);
+    moves_ = compiled;
+    owned_ = true;
+    perfect_ = nullptr;
+    return start();
+}
+
+void GameSession::startPerfect() {
+    perfect_ = &sharedPerfectTable();
+    start();
+}
+
+bool GameSession::start(const StrategyTable &moves) {
+    if (owned_) delete moves_;
+    owned_ = false;
+    moves_ = &moves;
+    perfect_ = nullptr;
+    return start();
+}
+
+bool GameSession::start() {
+    if (!moves_ && !perfect_) return false;
+    board_.x = board_.o = 0;
+    state_ = GAME_IN_PROGRESS;
+    return true;
+}
+
+int GameSession::programMove() {
+    int slot = pickReply();
+    if (slot < 0) return -1;
+    placeMark(board_, slot, 'X');
+    settle('X');
+    return slot;
+}
+
+bool GameSession::playerMove(int slot) {
+    if (slot < 0 || slot >= 9 || !isEmpty(board_, slot) || state_ != GAME_IN_PROGRESS || programToMove()) {
+        return false;
+    }
+    placeMark(board_, slot, 'O');
+    settle('O');
+    return true;
+}
+
+void GameSession::settle(char player) {
+    if (checkWin(board_, player)) {
+        state_ = (player == 'X') ? GAME_PROGRAM_WON : GAME_PLAYER_WON;
+    } else if (isFull(board_)) {
+        state_ = GAME_DRAW;
+    }
+}
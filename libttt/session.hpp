@@ -0,0 +1,65 @@
+#pragma once
+
+#include "ttt.hpp"
+#include "perfect.hpp"
+
+#include <cstdint>
+
+enum GameState : uint8_t {
+    GAME_IN_PROGRESS,
+    GAME_PROGRAM_WON,
+    GAME_PLAYER_WON,
+    GAME_DRAW
+};
+
+// One game of the program ('X', moving first) against a player ('O'),
+// independent of how moves reach it
+class GameSession {
+public:
+    GameSession();
+    ~GameSession();
+
+    // Plays by the strategy string; false if it is rejected. Resets the
+    // board.
+    bool start(const std::string &strategy);
+    // Plays perfectly. Resets the board.
+    void startPerfect();
+    // Plays by moves, compiled once and shared by any number of games; it
+    // must outlive the game. Resets the board.
+    bool start(const StrategyTable &moves);
+    // Starts a new game with the current strategy; false if none was set
+    bool start();
+
+    // The program's reply for the current board, without playing it; -1
+    // when programMove() would refuse to play
+    int pickReply() const {
+        if (!programToMove() || (!moves_ && !perfect_)) return -1;
+        return perfect_ ? perfectMove(*perfect_, board_) : pickMove(*moves_, board_);
+    }
+
+    // Plays the program's reply and returns its 0-based slot; -1 if it is
+    // not the program's turn, the game is over or it was never started
+    int programMove();
+
+    // Plays the player's 0-based slot; false if it is out of range, taken,
+    // or it is not the player's turn
+    bool playerMove(int slot);
+
+    GameState state() const { return state_; }
+    const Board &board() const { return board_; }
+    bool programToMove() const {
+        return state_ == GAME_IN_PROGRESS && __builtin_popcount(board_.x) == __builtin_popcount(board_.o);
+    }
+
+private:
+    GameSession(const GameSession &) = delete;
+    GameSession &operator=(const GameSession &) = delete;
+
+    void settle(char player);
+
+    Board board_;
+    GameState state_;
+    bool owned_; // moves_ was compiled by start(strategy), on its first use
+    const StrategyTable *moves_;
+    const PerfectTable *perfect_;
+};
@@ -0,0 +1,196 @@
+#include "driver.hpp"
+#include "session.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+static int failures = 0;
+
+static void expect(bool ok, const std::string &what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+// Runs ttt with args in a child fed input, and returns what it printed
+static std::string runTranscript(std::vector<const char *> args, const std::string &input, int &status) {
+    int in[2], out[2];
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        args.insert(args.begin(), "ttt");
+        args.push_back(nullptr);
+        int code = runTtt(static_cast<int>(args.size()) - 1, const_cast<char **>(args.data()));
+        std::cout.flush();
+        _exit(code);
+    }
+    close(in[0]);
+    close(out[1]);
+    // A game's input fits in the pipe, so it can all go before reading
+    if (write(in[1], input.data(), input.size()) != static_cast<ssize_t>(input.size())) {
+        perror("write");
+    }
+    close(in[1]);
+    std::string output;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(out[0], buffer, sizeof(buffer))) > 0) {
+        output.append(buffer, n);
+    }
+    close(out[0]);
+    waitpid(pid, &status, 0);
+    status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return output;
+}
+
+static void expectTranscript(std::vector<const char *> args, const std::string &input, const std::string &expected,
+                             int expectedStatus) {
+    std::string name = "ttt";
+    for (const char *arg : args) {
+        name += std::string(" ") + arg;
+    }
+    int status;
+    std::string output = runTranscript(args, input, status);
+    expect(output == expected, name + ": printed\n" + output + "instead of\n" + expected);
+    expect(status == expectedStatus, name + ": exit status " + std::to_string(status));
+}
+
+const char EMPTY[] = "   |   |  \n---|---|---\n   |   |  \n---|---|---\n   |   |  \n";
+
+// Transcripts of the original ttt, which the shared driver must keep
+static void testInteractive() {
+    expectTranscript({"123456789"}, "5\n4\n",
+                     std::string(EMPTY) +
+                         "1\n"
+                         " X |   |  \n---|---|---\n   | O |  \n---|---|---\n   |   |  \n"
+                         "2\n"
+                         " X | X |  \n---|---|---\n O | O |  \n---|---|---\n   |   |  \n"
+                         "3\n"
+                         " X | X | X\n---|---|---\n O | O |  \n---|---|---\n   |   |  \n"
+                         "I win\n",
+                     0);
+    expectTranscript({"123456789"}, "5\n3\n7\n",
+                     std::string(EMPTY) +
+                         "1\n"
+                         " X |   |  \n---|---|---\n   | O |  \n---|---|---\n   |   |  \n"
+                         "2\n"
+                         " X | X | O\n---|---|---\n   | O |  \n---|---|---\n   |   |  \n"
+                         "4\n"
+                         " X | X | O\n---|---|---\n X | O |  \n---|---|---\n O |   |  \n"
+                         "I lost\n",
+                     0);
+    expectTranscript({"513972468"}, "1\n2\n7\n6\n",
+                     std::string(EMPTY) +
+                         "5\n"
+                         " O |   |  \n---|---|---\n   | X |  \n---|---|---\n   |   |  \n"
+                         "3\n"
+                         " O | O | X\n---|---|---\n   | X |  \n---|---|---\n   |   |  \n"
+                         "9\n"
+                         " O | O | X\n---|---|---\n   | X |  \n---|---|---\n O |   | X\n"
+                         "4\n"
+                         " O | O | X\n---|---|---\n X | X | O\n---|---|---\n O |   | X\n"
+                         "8\n"
+                         " O | O | X\n---|---|---\n X | X | O\n---|---|---\n O | X | X\n"
+                         "DRAW\n",
+                     0);
+    // A taken slot, and a strategy that is not a permutation of 1-9
+    expectTranscript({"912345678"}, "9\n",
+                     std::string(EMPTY) + "9\nError\n", 1);
+    expectTranscript({"12345678"}, "", "Error\n", 1);
+}
+
+static void testMachine() {
+    expectTranscript({"--machine", "123456789"}, "5\nB\n4\n", "1\n2\nB XX..O....\n3\nW\n", 0);
+    expectTranscript({"--machine", "123456789"}, "5\n3\n7\n", "1\n2\n4\nL\n", 0);
+    // CRLF line endings, and a final line without one
+    expectTranscript({"--machine", "513972468"}, "1\r\n2\r\n7\n6", "5\n3\n9\n4\n8\nD\n", 0);
+    expectTranscript({"--machine", "123456789"}, "5\n5\n", "1\n2\nE\n", 1);
+    expectTranscript({"--machine", "123456789"}, "5\n10\n", "1\n2\nE\n", 1);
+    // Input ending mid-game
+    expectTranscript({"--machine", "123456789"}, "5\n", "1\n2\n", 1);
+}
+
+static void testSession() {
+    GameSession session;
+    expect(session.pickReply() == -1, "pickReply() before start");
+    expect(session.programMove() == -1, "programMove() before start");
+    expect(!session.start(), "start() with no strategy");
+    expect(!session.start("12345678"), "start() with a short strategy");
+    expect(!session.start("123456788"), "start() with a repeated slot");
+
+    expect(session.start("123456789"), "start() with a valid strategy");
+    expect(!session.playerMove(4), "playerMove() before the program's");
+    expect(session.programMove() == 0, "first programMove()");
+    expect(session.programMove() == -1, "programMove() on the player's turn");
+    expect(!session.playerMove(0), "playerMove() on a taken slot");
+    expect(!session.playerMove(-1) && !session.playerMove(9), "playerMove() out of range");
+    expect(session.playerMove(4), "playerMove() on a free slot");
+    expect(session.pickReply() == 1, "pickReply() follows the strategy");
+    expect(session.board().x == 0x001 && session.board().o == 0x010, "board after two moves");
+
+    // start() keeps the strategy and clears the board
+    expect(session.start() && session.board().x == 0 && session.board().o == 0, "start() resets the board");
+    expect(session.state() == GAME_IN_PROGRESS, "start() resets the state");
+}
+
+// Every game a player can play against perfect play, none of them lost
+static void playAllReplies(GameSession &session, std::vector<int> &moves, int &games, int &lost) {
+    if (session.state() != GAME_IN_PROGRESS) {
+        ++games;
+        if (session.state() == GAME_PLAYER_WON) ++lost;
+        return;
+    }
+    if (session.programToMove()) {
+        session.programMove();
+        playAllReplies(session, moves, games, lost);
+        return;
+    }
+    Board board = session.board();
+    for (int slot = 0; slot < 9; ++slot) {
+        if (!isEmpty(board, slot)) continue;
+        // Replay the game so far, then try slot
+        session.startPerfect();
+        for (int move : moves) {
+            session.programMove();
+            session.playerMove(move);
+        }
+        session.programMove();
+        moves.push_back(slot);
+        session.playerMove(slot);
+        playAllReplies(session, moves, games, lost);
+        moves.pop_back();
+    }
+}
+
+static void testPerfect() {
+    GameSession session;
+    session.startPerfect();
+    std::vector<int> moves;
+    int games = 0, lost = 0;
+    playAllReplies(session, moves, games, lost);
+    expect(games > 0 && lost == 0, "perfect play lost " + std::to_string(lost) + " of " + std::to_string(games));
+}
+
+int main() {
+    testInteractive();
+    testMachine();
+    testSession();
+    testPerfect();
+    if (failures == 0) std::cout << "session: ok\n";
+    return failures == 0 ? 0 : 1;
+}
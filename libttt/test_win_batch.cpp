@@ -0,0 +1,35 @@
+#include "ttt.hpp"
+#include <vector>
+
+// checkWinBatch against isWinning on every pair of 9-bit masks, once per
+// backend this CPU can run
+int main() {
+    const size_t masks = FULL_BOARD + 1;
+    const size_t boards = masks * masks;
+    std::vector<BoardBatch> batch(boards / BATCH_BOARDS);
+    std::vector<uint32_t> xExpected(batch.size(), 0), oExpected(batch.size(), 0);
+    for (size_t i = 0; i < boards; ++i) {
+        uint16_t x = static_cast<uint16_t>(i / masks);
+        uint16_t o = static_cast<uint16_t>(i % masks);
+        batch[i / BATCH_BOARDS].x[i % BATCH_BOARDS] = x;
+        batch[i / BATCH_BOARDS].o[i % BATCH_BOARDS] = o;
+        uint32_t bit = 1u << (i % BATCH_BOARDS);
+        if (isWinning(x)) xExpected[i / BATCH_BOARDS] |= bit;
+        if (isWinning(o)) oExpected[i / BATCH_BOARDS] |= bit;
+    }
+
+    int failures = 0;
+    const char *backends[] = {"avx2", "sse2", "scalar"};
+    for (const char *name : backends) {
+        if (!useWinBatchBackend(name)) {
+            std::cout << name << ": not supported here, skipped\n";
+            continue;
+        }
+        std::vector<uint32_t> xWins(batch.size()), oWins(batch.size());
+        checkWinBatch(batch.data(), batch.size(), xWins.data(), oWins.data());
+        bool match = xWins == xExpected && oWins == oExpected;
+        std::cout << name << ": " << (match ? "ok" : "FAILED") << "\n";
+        if (!match) ++failures;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+#include "tournament.hpp"
+#include "ttt.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const uint32_t STRATEGY_COUNT = 362880; // 9!
+const uint32_t CHUNK_SIZE = 720;        // Strategies sharing their first three slots
+const uint32_t CHUNK_COUNT = STRATEGY_COUNT / CHUNK_SIZE;
+
+// Outcome counts of one strategy over every opponent move sequence
+struct StrategyRecord {
+    uint16_t wins;
+    uint16_t draws;
+    uint16_t losses;
+};
+
+// Walks the whole game tree of one strategy: the program's reply is fixed,
+// the opponent branches over every empty cell.
+void playFrom(const uint16_t order[9], Board board, StrategyRecord &record) {
+    uint16_t empty = emptyCells(board);
+    int i = 0;
+    while (!(empty & order[i])) {
+        ++i;
+    }
+    board.x |= order[i];
+    if (isWinning(board.x)) {
+        ++record.wins;
+        return;
+    }
+    if (isFull(board)) {
+        ++record.draws;
+        return;
+    }
+
+    for (uint16_t free = emptyCells(board); free; free &= free - 1) {
+        Board next = board;
+        next.o |= free & -free;
+        if (isWinning(next.o)) {
+            ++record.losses;
+        } else if (isFull(next)) {
+            ++record.draws;
+        } else {
+            playFrom(order, next, record);
+        }
+    }
+}
+
+StrategyRecord scoreStrategy(const char *strategy) {
+    uint16_t order[9];
+    for (int i = 0; i < 9; ++i) {
+        order[i] = static_cast<uint16_t>(1u << (strategy[i] - '1'));
+    }
+    StrategyRecord record = {0, 0, 0};
+    Board board = {0, 0};
+    playFrom(order, board, record);
+    return record;
+}
+
+// The index-th permutation of "123456789" in lexicographic order
+std::string unrankStrategy(uint32_t index) {
+    std::string digits = "123456789";
+    std::string strategy;
+    uint32_t factorial = STRATEGY_COUNT;
+    for (uint32_t n = 9; n > 0; --n) {
+        factorial /= n;
+        uint32_t pick = index / factorial;
+        index %= factorial;
+        strategy += digits[pick];
+        digits.erase(pick, 1);
+    }
+    return strategy;
+}
+
+struct Range {
+    uint32_t begin;
+    uint32_t end;
+};
+
+// Per-worker deque of strategy ranges: the owner pops from the back, idle
+// workers steal from the front.
+class WorkQueue {
+public:
+    void push(Range range) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ranges_.push_back(range);
+    }
+
+    bool pop(Range &range) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ranges_.empty()) return false;
+        range = ranges_.back();
+        ranges_.pop_back();
+        return true;
+    }
+
+    bool steal(Range &range) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ranges_.empty()) return false;
+        range = ranges_.front();
+        ranges_.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<Range> ranges_;
+};
+
+void playRange(Range range, std::vector<StrategyRecord> &records) {
+    std::string strategy = unrankStrategy(range.begin);
+    for (uint32_t index = range.begin; index < range.end; ++index) {
+        records[index] = scoreStrategy(strategy.c_str());
+        std::next_permutation(strategy.begin(), strategy.end());
+    }
+}
+
+void worker(unsigned self, std::vector<WorkQueue> &queues, std::vector<StrategyRecord> &records) {
+    Range range;
+    while (true) {
+        if (queues[self].pop(range)) {
+            playRange(range, records);
+            continue;
+        }
+        // No new work is ever queued, so one failed sweep means we are done
+        bool stole = false;
+        for (size_t k = 1; k < queues.size() && !stole; ++k) {
+            stole = queues[(self + k) % queues.size()].steal(range);
+        }
+        if (!stole) return;
+        playRange(range, records);
+    }
+}
+
+void appendNumber(std::string &out, unsigned long value) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (n) {
+        out += digits[--n];
+    }
+}
+
+} // namespace
+
+bool parseThreads(const char *text, unsigned &threads) {
+    if (*text < '0' || *text > '9') return false;
+    char *end;
+    errno = 0;
+    unsigned long count = std::strtoul(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE) return false;
+    threads = static_cast<unsigned>(std::min<unsigned long>(count, CHUNK_COUNT));
+    return true;
+}
+
+int runTournament(unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // A thread past the chunk count would have nothing to do
+    threads = std::min(threads, CHUNK_COUNT);
+
+    std::vector<StrategyRecord> records(STRATEGY_COUNT);
+    std::vector<WorkQueue> queues(threads);
+    for (uint32_t begin = 0, k = 0; begin < STRATEGY_COUNT; begin += CHUNK_SIZE, ++k) {
+        Range range = {begin, std::min(begin + CHUNK_SIZE, STRATEGY_COUNT)};
+        queues[k % threads].push(range);
+    }
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < threads; ++t) {
+        workers.emplace_back(worker, t, std::ref(queues), std::ref(records));
+    }
+    worker(0, queues, records);
+    for (std::thread &t : workers) {
+        t.join();
+    }
+
+    // Fewest losses first, then most wins; ties keep lexicographic order
+    std::vector<uint32_t> ranking(STRATEGY_COUNT);
+    for (uint32_t i = 0; i < STRATEGY_COUNT; ++i) {
+        ranking[i] = i;
+    }
+    std::stable_sort(ranking.begin(), ranking.end(), [&records](uint32_t a, uint32_t b) {
+        if (records[a].losses != records[b].losses) return records[a].losses < records[b].losses;
+        return records[a].wins > records[b].wins;
+    });
+
+    std::string out;
+    out.reserve(STRATEGY_COUNT * 32);
+    out += "rank strategy wins draws losses\n";
+    for (uint32_t rank = 0; rank < STRATEGY_COUNT; ++rank) {
+        const StrategyRecord &record = records[ranking[rank]];
+        appendNumber(out, rank + 1);
+        out += ' ';
+        out += unrankStrategy(ranking[rank]);
+        out += ' ';
+        appendNumber(out, record.wins);
+        out += ' ';
+        appendNumber(out, record.draws);
+        out += ' ';
+        appendNumber(out, record.losses);
+        out += '\n';
+    }
+    std::cout.write(out.data(), out.size());
+    std::cout.flush();
+    return 0;
+}
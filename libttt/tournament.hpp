@@ -0,0 +1,6 @@
+#pragma once
+
+// Reads the --tournament thread count: 0 for one per CPU, and no more than
+// there are chunks of work to share. False if text is not a count.
+bool parseThreads(const char *text, unsigned &threads);
+int runTournament(unsigned threads);
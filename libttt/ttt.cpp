@@ -0,0 +1,49 @@
+#include "ttt.hpp"
+
+void printErrorAndExit() {
+    std::cout << "Error\n";
+    exit(1);
+}
+
+bool isValidStrategy(const std::string &strategy) {
+    if (strategy.size() != 9) return false;
+    unsigned seen = 0;
+    for (char c : strategy) {
+        if (c < '1' || c > '9') return false;
+        unsigned bit = 1u << (c - '1');
+        if (seen & bit) return false;
+        seen |= bit;
+    }
+    return true;
+}
+
+static char cellAt(const Board &board, int slot) {
+    if ((board.x >> slot) & 1) return 'X';
+    if ((board.o >> slot) & 1) return 'O';
+    return ' ';
+}
+
+void formatBoard(const Board &board, std::string &out) {
+    for (int i = 0; i < 9; i += 3) {
+        out += ' ';
+        out += cellAt(board, i);
+        out += " | ";
+        out += cellAt(board, i + 1);
+        out += " | ";
+        out += cellAt(board, i + 2);
+        out += '\n';
+        if (i < 6) {
+            out += "---|---|---\n";
+        }
+    }
+}
+
+void printBoard(const Board &board) {
+    std::string text;
+    formatBoard(board, text);
+    std::cout << text;
+}
+
+bool checkWin(const Board &board, char player) {
+    return isWinning((player == 'X') ? board.x : board.o);
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+
+// Board state as two 9-bit occupancy masks; bit i is slot i + 1 (row-major)
+struct Board {
+    uint16_t x; // Program's marks
+    uint16_t o; // Player's marks
+};
+
+const uint16_t FULL_BOARD = 0x1FF;
+
+// All possible winning combinations as occupancy masks
+constexpr uint16_t WIN_MASKS[8] = {
+    0x007, // Row 1
+    0x038, // Row 2
+    0x1C0, // Row 3
+    0x049, // Column 1
+    0x092, // Column 2
+    0x124, // Column 3
+    0x111, // Diagonal from top-left to bottom-right
+    0x054  // Diagonal from top-right to bottom-left
+};
+
+inline bool isWinning(uint16_t marks) {
+    for (uint16_t combo : WIN_MASKS) {
+        if ((marks & combo) == combo) return true;
+    }
+    return false;
+}
+
+inline uint16_t emptyCells(const Board &board) {
+    return static_cast<uint16_t>(~(board.x | board.o) & FULL_BOARD);
+}
+
+inline bool isEmpty(const Board &board, int slot) {
+    return (emptyCells(board) >> slot) & 1;
+}
+
+inline bool isFull(const Board &board) {
+    return (board.x | board.o) == FULL_BOARD;
+}
+
+inline void placeMark(Board &board, int slot, char player) {
+    uint16_t bit = static_cast<uint16_t>(1u << slot);
+    if (player == 'X') {
+        board.x |= bit;
+    } else {
+        board.o |= bit;
+    }
+}
+
+const uint8_t NO_MOVE = 0xFF;
+
+// Program's reply for every board occupancy, compiled once from a strategy
+struct StrategyTable {
+    uint8_t moves[512]; // 0-based slot, or NO_MOVE when the board is full
+};
+
+inline void compileStrategy(const std::string &strategy, StrategyTable &table) {
+    for (unsigned occupied = 0; occupied <= FULL_BOARD; ++occupied) {
+        table.moves[occupied] = NO_MOVE;
+        for (char c : strategy) {
+            int slot = c - '1';
+            if (!((occupied >> slot) & 1)) {
+                table.moves[occupied] = static_cast<uint8_t>(slot);
+                break;
+            }
+        }
+    }
+}
+
+inline int pickMove(const StrategyTable &table, const Board &board) {
+    return table.moves[board.x | board.o];
+}
+
+void printErrorAndExit();
+bool isValidStrategy(const std::string &strategy);
+void printBoard(const Board &board);
+// Appends the board as printBoard() prints it
+void formatBoard(const Board &board, std::string &out);
+bool checkWin(const Board &board, char player);
+
+const int BATCH_BOARDS = 32;
+
+// A block of boards in struct-of-arrays form for checkWinBatch
+struct BoardBatch {
+    alignas(32) uint16_t x[BATCH_BOARDS];
+    alignas(32) uint16_t o[BATCH_BOARDS];
+};
+
+// Bit i of xWins / oWins is set when board i of a block has a completed
+// line for that player; one pair of words per block
+void checkWinBatch(const BoardBatch *blocks, size_t count, uint32_t *xWins, uint32_t *oWins);
+// Name of the implementation picked for this CPU ("avx2", "sse2" or "scalar"),
+// or the one TTT_WIN_BATCH in the environment names, if the CPU has it
+const char *checkWinBatchBackend();
+// Switches checkWinBatch to the named implementation, before any other
+// thread uses it; false, keeping the current one, if the CPU lacks it
+bool useWinBatchBackend(const char *name);
@@ -0,0 +1,123 @@
+#include "ttt.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TTT_X86 1
+#endif
+
+namespace {
+
+typedef uint32_t (*WinMaskFn)(const uint16_t *marks);
+
+uint32_t winMaskScalar(const uint16_t *marks) {
+    uint32_t wins = 0;
+    for (int i = 0; i < BATCH_BOARDS; ++i) {
+        wins |= static_cast<uint32_t>(isWinning(marks[i])) << i;
+    }
+    return wins;
+}
+
+#ifdef TTT_X86
+
+// Eight boards per register: a lane is all ones when it holds any win mask
+__attribute__((target("sse2"))) __m128i anyWin128(__m128i marks) {
+    __m128i hit = _mm_setzero_si128();
+    for (uint16_t combo : WIN_MASKS) {
+        __m128i m = _mm_set1_epi16(static_cast<short>(combo));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi16(_mm_and_si128(marks, m), m));
+    }
+    return hit;
+}
+
+__attribute__((target("sse2"))) uint32_t winMaskSse2(const uint16_t *marks) {
+    const __m128i *v = reinterpret_cast<const __m128i *>(marks);
+    __m128i low = _mm_packs_epi16(anyWin128(_mm_loadu_si128(v)), anyWin128(_mm_loadu_si128(v + 1)));
+    __m128i high = _mm_packs_epi16(anyWin128(_mm_loadu_si128(v + 2)), anyWin128(_mm_loadu_si128(v + 3)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(low)) |
+           (static_cast<uint32_t>(_mm_movemask_epi8(high)) << 16);
+}
+
+// Sixteen boards per register
+__attribute__((target("avx2"))) __m256i anyWin256(__m256i marks) {
+    __m256i hit = _mm256_setzero_si256();
+    for (uint16_t combo : WIN_MASKS) {
+        __m256i m = _mm256_set1_epi16(static_cast<short>(combo));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi16(_mm256_and_si256(marks, m), m));
+    }
+    return hit;
+}
+
+__attribute__((target("avx2"))) uint32_t winMaskAvx2(const uint16_t *marks) {
+    const __m256i *v = reinterpret_cast<const __m256i *>(marks);
+    // packs works per 128-bit lane, so restore board order with a permute
+    __m256i packed = _mm256_packs_epi16(anyWin256(_mm256_loadu_si256(v)), anyWin256(_mm256_loadu_si256(v + 1)));
+    packed = _mm256_permute4x64_epi64(packed, 0xD8);
+    return static_cast<uint32_t>(_mm256_movemask_epi8(packed));
+}
+
+#endif
+
+struct Backend {
+    WinMaskFn fn;
+    const char *name;
+};
+
+// The named implementation, if this CPU can run it
+bool findBackend(const char *name, Backend &found) {
+#ifdef TTT_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        found = {winMaskAvx2, "avx2"};
+        return true;
+    }
+    if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        found = {winMaskSse2, "sse2"};
+        return true;
+    }
+#endif
+    if (strcmp(name, "scalar") == 0) {
+        found = {winMaskScalar, "scalar"};
+        return true;
+    }
+    return false;
+}
+
+Backend selectBackend() {
+    Backend chosen;
+    const char *forced = getenv("TTT_WIN_BATCH");
+    if (forced && findBackend(forced, chosen)) return chosen;
+    const char *fastest[] = {"avx2", "sse2", "scalar"};
+    for (const char *name : fastest) {
+        if (findBackend(name, chosen)) break;
+    }
+    return chosen;
+}
+
+Backend &backend() {
+    static Backend chosen = selectBackend();
+    return chosen;
+}
+
+} // namespace
+
+void checkWinBatch(const BoardBatch *blocks, size_t count, uint32_t *xWins, uint32_t *oWins) {
+    WinMaskFn fn = backend().fn;
+    for (size_t i = 0; i < count; ++i) {
+        xWins[i] = fn(blocks[i].x);
+        oWins[i] = fn(blocks[i].o);
+    }
+}
+
+const char *checkWinBatchBackend() {
+    return backend().name;
+}
+
+bool useWinBatchBackend(const char *name) {
+    Backend found;
+    if (!findBackend(name, found)) return false;
+    backend() = found;
+    return true;
+}
@@ -1,9 +1,74 @@
 #include <iostream>
 #include <string>
-#include <vector>
-#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+
+// Board state as two 9-bit occupancy masks; bit i is slot i + 1 (row-major)
+struct Board {
+    uint16_t x; // Program's marks
+    uint16_t o; // Player's marks
+};
+
+const uint16_t FULL_BOARD = 0x1FF;
+
+// All possible winning combinations as occupancy masks
+constexpr uint16_t WIN_MASKS[8] = {
+    0x007, // Row 1
+    0x038, // Row 2
+    0x1C0, // Row 3
+    0x049, // Column 1
+    0x092, // Column 2
+    0x124, // Column 3
+    0x111, // Diagonal from top-left to bottom-right
+    0x054  // Diagonal from top-right to bottom-left
+};
+
+inline uint16_t emptyCells(const Board &board) {
+    return static_cast<uint16_t>(~(board.x | board.o) & FULL_BOARD);
+}
+
+inline bool isEmpty(const Board &board, int slot) {
+    return (emptyCells(board) >> slot) & 1;
+}
+
+inline bool isFull(const Board &board) {
+    return (board.x | board.o) == FULL_BOARD;
+}
+
+inline void placeMark(Board &board, int slot, char player) {
+    uint16_t bit = static_cast<uint16_t>(1u << slot);
+    if (player == 'X') {
+        board.x |= bit;
+    } else {
+        board.o |= bit;
+    }
+}
+
+const uint8_t NO_MOVE = 0xFF;
+
+// Program's reply for every board occupancy, compiled once from a strategy
+struct StrategyTable {
+    uint8_t moves[512]; // 0-based slot, or NO_MOVE when the board is full
+};
+
+inline void compileStrategy(const std::string &strategy, StrategyTable &table) {
+    for (unsigned occupied = 0; occupied <= FULL_BOARD; ++occupied) {
+        table.moves[occupied] = NO_MOVE;
+        for (char c : strategy) {
+            int slot = c - '1';
+            if (!((occupied >> slot) & 1)) {
+                table.moves[occupied] = static_cast<uint8_t>(slot);
+                break;
+            }
+        }
+    }
+}
+
+inline int pickMove(const StrategyTable &table, const Board &board) {
+    return table.moves[board.x | board.o];
+}
 
 void printErrorAndExit();
 bool isValidStrategy(const std::string &strategy);
-void printBoard(const std::vector<char> &board);
-bool checkWin(const std::vector<char> &board, char player);
+void printBoard(const Board &board);
+bool checkWin(const Board &board, char player);
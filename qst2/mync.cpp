@@ -1,6 +1,6 @@
+#include "command.hpp"
+
 #include <iostream>
-#include <sstream>
-#include <vector>
 #include <unistd.h>
 #include <sys/wait.h>
 
@@ -9,38 +9,16 @@ void printErrorAndExit() {
     exit(1);
 }
 
-std::vector<char*> parseCommand(const std::string& command) {
-    std::istringstream iss(command);
-    std::vector<std::string> tokens;
-    std::string token;
-    while (iss >> token) {
-        tokens.push_back(token);
-    }
-
-    std::vector<char*> args;
-    for (auto& t : tokens) {
-        args.push_back(&t[0]);
-    }
-    args.push_back(nullptr);
-    return args;
-}
-
 int main(int argc, char* argv[]) {
     if (argc != 3 || std::string(argv[1]) != "-e") {
         printErrorAndExit();
     }
 
-    std::string command = argv[2];
-    std::vector<char*> args = parseCommand(command);
+    Command command = parseCommand(argv[2]);
 
-    pid_t pid = fork();
+    pid_t pid = spawnCommand(command);
     if (pid == -1) {
         printErrorAndExit();
-    } else if (pid == 0) {
-        // Child process
-        if (execvp(args[0], args.data()) == -1) {
-            printErrorAndExit();
-        }
     } else {
         // Parent process
         int status;
@@ -6,9 +6,10 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <cstring>
-#include <netdb.h>
 #include <csignal>
 #include <sys/wait.h>
+#include "connector.hpp"
+#include "relay.hpp"
 
 // Function to print an error message and exit the program
 void printErrorAndExit() {
@@ -49,39 +50,18 @@ void handleServerInput(int port, int &input_fd) {
     }
 
     // Accept a connection
-    input_fd = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen);
+    input_fd = accept4(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen, SOCK_CLOEXEC);
     if (input_fd < 0) {
         printErrorAndExit();
     }
 }
 
-// Function to handle client-side TCP output
+// Function to handle client-side TCP output, waiting for the server to come up
 void handleClientOutput(const std::string &host, int port, int &output_fd) {
-    // Create a socket
-    output_fd = socket(AF_INET, SOCK_STREAM, 0);
+    output_fd = connectTo(host, port, SOCK_STREAM);
     if (output_fd < 0) {
         printErrorAndExit();
     }
-
-    struct sockaddr_in serv_addr;
-    struct hostent *server;
-
-    // Get the server's address by hostname
-    server = gethostbyname(host.c_str());
-    if (server == nullptr) {
-        printErrorAndExit();
-    }
-
-    // Set up the address structure
-    bzero((char *)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    bcopy((char *)server->h_addr, (char *)&serv_addr.sin_addr.s_addr, server->h_length);
-    serv_addr.sin_port = htons(port);
-
-    // Connect to the server
-    if (connect(output_fd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        printErrorAndExit();
-    }
 }
 
 // Function to redirect input and output
@@ -102,10 +82,13 @@ int main(int argc, char *argv[]) {
     if (argc < 3) {
         printErrorAndExit();
     }
+    // A peer that goes away must be an EPIPE for the relay to handle rather
+    // than end mync; the program gets SIGPIPE back when started
+    signal(SIGPIPE, SIG_IGN);
 
     std::string exec_command;
     int input_fd = -1, output_fd = -1;
-    bool input_tcp = false, output_tcp = false;
+    bool input_tcp = false, output_tcp = false, bidirectional = false;
     std::string input_host, output_host;
     int input_port = -1, output_port = -1;
 
@@ -141,9 +124,8 @@ int main(int argc, char *argv[]) {
             std::string param = argv[++i];
             if (param.substr(0, 4) == "TCPS") {
                 input_tcp = true;
-                output_tcp = true;
+                bidirectional = true;
                 input_port = std::stoi(param.substr(4));
-                output_port = input_port; // Use the same port for bi-directional
             } else {
                 printErrorAndExit();
             }
@@ -157,31 +139,28 @@ int main(int argc, char *argv[]) {
         handleServerInput(input_port, input_fd);
     }
 
+    // The bi-directional socket is also the output
+    if (bidirectional) {
+        output_fd = input_fd;
+    }
+
     // Handle TCP output if specified
     if (output_tcp) {
         handleClientOutput(output_host, output_port, output_fd);
     }
 
-    // If no command to execute, transfer data between input and output
+    // If no command to execute, relay data between the endpoints and the terminal
     if (exec_command.empty()) {
-        if (input_tcp) {
-            char buffer[1024];
-            ssize_t bytes_read;
-            while ((bytes_read = read(input_fd, buffer, sizeof(buffer))) > 0) {
-                write(STDOUT_FILENO, buffer, bytes_read);
-            }
-        } else if (output_tcp) {
-            char buffer[1024];
-            ssize_t bytes_read;
-            while ((bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
-                write(output_fd, buffer, bytes_read);
-            }
-        } else {
-            char buffer[1024];
-            ssize_t bytes_read;
-            while ((bytes_read = read(STDIN_FILENO, buffer, sizeof(buffer))) > 0) {
-                write(STDOUT_FILENO, buffer, bytes_read);
-            }
+        RelayEndpoint terminal = {STDIN_FILENO, STDOUT_FILENO, false};
+        RelayEndpoint input = terminal, output = terminal;
+        if (input_fd >= 0) {
+            input = RelayEndpoint{input_fd, input_fd, true};
+        }
+        if (output_fd >= 0 && output_fd != input_fd) {
+            output = RelayEndpoint{output_fd, output_fd, true};
+        }
+        if (runRelay(input, output) < 0) {
+            printErrorAndExit();
         }
     } else {
         // Fork a new process to execute the command
@@ -198,6 +177,7 @@ int main(int argc, char *argv[]) {
                 dup2(output_fd, STDOUT_FILENO);
             }
             // Execute the command
+            signal(SIGPIPE, SIG_DFL);
             execl("/bin/sh", "sh", "-c", exec_command.c_str(), (char *)0);
             printErrorAndExit();
         } else {
@@ -208,7 +188,7 @@ int main(int argc, char *argv[]) {
 
     // Close the file descriptors
     if (input_fd >= 0) close(input_fd);
-    if (output_fd >= 0) close(output_fd);
+    if (output_fd >= 0 && output_fd != input_fd) close(output_fd);
 
     return 0;
 }
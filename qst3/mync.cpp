@@ -41,7 +41,7 @@ void handleServerInput(int port, int &input_fd) {
         printErrorAndExit("Failed to listen on server socket");
     }
 
-    input_fd = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen);
+    input_fd = accept4(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen, SOCK_CLOEXEC);
     if (input_fd < 0) {
         printErrorAndExit("Failed to accept connection on server socket");
     }
@@ -1,15 +1,27 @@
+#include "builtin.hpp"
+#include "command.hpp"
+#include "connector.hpp"
+#include "datagram.hpp"
+#include "event_loop.hpp"
+#include "runtime.hpp"
+#include "server.hpp"
+#include "session.hpp"
+#include "trace.hpp"
+#include "ttt_session.hpp"
+
 #include <iostream>
 #include <string>
 #include <vector>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
-#include <netdb.h>
 #include <csignal>
 #include <sys/wait.h>
 #include <sys/socket.h>
+#include <fcntl.h>
 
 /**
  * Prints an error message to stderr and exits the program with a failure status.
@@ -21,87 +33,105 @@ void printErrorAndExit(const std::string &message) {
 }
 
 /**
- * Signal handler for timeout. Prints an error message and exits.
- * @param sig The signal number.
+ * Ends a program whose time is up, traces it, then exits with the timeout error.
+ * @param pid The program's process ID.
  */
-void handleTimeout(int sig) {
-    (void)sig; // To avoid unused parameter warning
+void stopOnTimeout(pid_t pid) {
+    kill(pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+    if (ConnectionTrace *trace = processTrace()) {
+        trace->end(status);
+    }
     printErrorAndExit("Timeout reached, exiting.");
 }
 
 /**
- * Sets up the server side to handle input from a TCP or UDP client.
- * @param port The port number to listen on.
- * @param input_fd Reference to the input file descriptor.
- * @param is_udp Flag to indicate if the server should use UDP (true) or TCP (false).
+ * Opens a socket bound to the given port, listening when it is TCP.
+ * @param port The port number to bind.
+ * @param is_udp Flag to indicate if the socket should use UDP (true) or TCP (false).
+ * @param serving Flag to share the port with other acceptor processes and queue many clients.
+ * @return The socket file descriptor.
  */
-void handleServerInput(int port, int &input_fd, bool is_udp) {
+int openServerSocket(int port, bool is_udp, bool serving) {
     struct sockaddr_in server_addr;
+    int fd;
 
     if (is_udp) {
-        input_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
     } else {
-        input_fd = socket(AF_INET, SOCK_STREAM, 0);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
     }
 
-    if (input_fd < 0) {
+    if (fd < 0) {
         printErrorAndExit("Failed to create socket: " + std::string(strerror(errno)));
     }
 
+    if (serving) {
+        int on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+            printErrorAndExit("Failed to share socket: " + std::string(strerror(errno)));
+        }
+    }
+
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(port);
 
-    if (bind(input_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+    if (bind(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         printErrorAndExit("Failed to bind socket: " + std::string(strerror(errno)));
     }
 
     if (!is_udp) {
-        if (listen(input_fd, 1) < 0) {
+        if (listen(fd, serving ? SOMAXCONN : 1) < 0) {
             printErrorAndExit("Failed to listen on socket: " + std::string(strerror(errno)));
         }
-        int client_fd = accept(input_fd, nullptr, nullptr);
+    }
+    return fd;
+}
+
+/**
+ * Sets up the server side to handle input from a TCP or UDP client.
+ * @param port The port number to listen on.
+ * @param input_fd Reference to the input file descriptor.
+ * @param is_udp Flag to indicate if the server should use UDP (true) or TCP (false).
+ */
+void handleServerInput(int port, int &input_fd, bool is_udp) {
+    input_fd = openServerSocket(port, is_udp, false);
+    ConnectionTrace *trace = processTrace();
+    if (trace) {
+        trace->mark(TRACE_BIND);
+    }
+
+    if (!is_udp) {
+        int client_fd = accept4(input_fd, nullptr, nullptr, SOCK_CLOEXEC);
         if (client_fd < 0) {
             printErrorAndExit("Failed to accept connection: " + std::string(strerror(errno)));
         }
+        if (trace) {
+            trace->mark(TRACE_ACCEPT);
+            trace->setPeer(client_fd);
+        }
         close(input_fd);
         input_fd = client_fd;
     }
 }
 
 /**
- * Sets up the client side to send output to a TCP or UDP server.
- * @param host The server hostname or IP address.
+ * Sets up the client side to send output to a TCP or UDP server, waiting for it to come up.
+ * @param host The server hostname or IPv4/IPv6 address.
  * @param port The port number to connect to.
  * @param output_fd Reference to the output file descriptor.
  * @param is_udp Flag to indicate if the client should use UDP (true) or TCP (false).
+ * @param options How long to keep retrying.
  */
-void handleClientOutput(const std::string &host, int port, int &output_fd, bool is_udp) {
-    struct sockaddr_in server_addr;
-    struct hostent *server = gethostbyname(host.c_str());
-
-    if (server == nullptr) {
-        printErrorAndExit("Failed to get host by name");
-    }
-
-    if (is_udp) {
-        output_fd = socket(AF_INET, SOCK_DGRAM, 0);
-    } else {
-        output_fd = socket(AF_INET, SOCK_STREAM, 0);
-    }
-
+void handleClientOutput(const std::string &host, int port, int &output_fd, bool is_udp,
+                        const ConnectOptions &options) {
+    output_fd = connectTo(host, port, is_udp ? SOCK_DGRAM : SOCK_STREAM, options);
     if (output_fd < 0) {
-        printErrorAndExit("Failed to create socket");
-    }
-
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    memcpy(&server_addr.sin_addr.s_addr, server->h_addr, server->h_length);
-    server_addr.sin_port = htons(port);
-
-    if (connect(output_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        printErrorAndExit("Failed to connect to server");
+        printErrorAndExit("Failed to connect to server: " + std::string(strerror(errno)));
     }
 }
 
@@ -125,17 +155,78 @@ void redirectOutput(int fd) {
     }
 }
 
+/**
+ * Creates the datagram channel that stands in for a UDP socket on the program's side.
+ * @param child_end Reference to the program's end.
+ * @param engine_end Reference to mync's end.
+ */
+void createChannel(int &child_end, int &engine_end) {
+    if (!createDatagramChannel(child_end, engine_end)) {
+        printErrorAndExit("Failed to create datagram channel: " + std::string(strerror(errno)));
+    }
+}
+
+/**
+ * Creates a pipe whose ends are closed when a program is executed.
+ * @param read_end Reference to the read end.
+ * @param write_end Reference to the write end.
+ */
+void createPipe(int &read_end, int &write_end) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        printErrorAndExit("Failed to create pipe: " + std::string(strerror(errno)));
+    }
+    read_end = fds[0];
+    write_end = fds[1];
+}
+
+/**
+ * Replaces the current process with the program, run directly or through the shell.
+ * @param command The parsed command line to execute.
+ */
+void execProgram(const Command &command) {
+    execCommand(command);
+    printErrorAndExit("Failed to execute program");
+}
+
+/**
+ * Checks the arguments of a builtin program once, up front, and makes its sessions.
+ * @param command The parsed -e command line, starting with builtin:<name>.
+ * @return The factory that makes one session per connection.
+ */
+SessionFactory builtinProgram(const Command &command) {
+    const std::vector<std::string> &args = command.args;
+    if (command.shell || args[0] != "builtin:ttt") {
+        printErrorAndExit("Unknown builtin program: " + args[0]);
+    }
+    bool machine = args.size() == 3 && args[1] == "--machine";
+    if (args.size() != (machine ? 3u : 2u)) {
+        printErrorAndExit("Usage: builtin:ttt [--machine] <strategy>");
+    }
+    std::string strategy = args.back();
+    if (strategy != "--perfect" && !isValidStrategy(strategy)) {
+        printErrorAndExit("Invalid strategy for builtin:ttt");
+    }
+    return tttSessions(strategy, machine);
+}
 
 int main(int argc, char *argv[]) {
     if (argc < 3) {
         printErrorAndExit("Invalid number of arguments");
     }
+    // A client or -o peer that goes away must be an EPIPE for the relays to
+    // handle rather than end mync; programs get SIGPIPE back when started
+    signal(SIGPIPE, SIG_IGN);
 
     std::string executable;
     bool input_tcp = false, output_tcp = false, input_udp = false, output_udp = false;
-    int input_port = -1, output_port = -1, timeout = -1;
+    bool bidirectional = false, serve = false;
+    int input_port = -1, output_port = -1, timeout = -1, idle_timeout = -1, read_timeout = -1;
+    int acceptors = 1, max_clients = 0, pool = 0, threads = 1;
+    DatagramOptions datagram_options = DEFAULT_DATAGRAM_OPTIONS;
+    ConnectOptions connect_options = DEFAULT_CONNECT_OPTIONS;
     int input_fd = -1, output_fd = -1;
-    std::string output_host;
+    std::string output_host, trace_target;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -177,14 +268,54 @@ int main(int argc, char *argv[]) {
             std::string param = argv[++i];
             if (param.substr(0, 4) == "TCPS") {
                 input_tcp = true;
-                output_tcp = true;
+                bidirectional = true;
+                input_port = std::stoi(param.substr(4));
+            } else if (param.substr(0, 4) == "UDPS") {
+                input_udp = true;
+                bidirectional = true;
                 input_port = std::stoi(param.substr(4));
-                output_port = input_port;
             } else {
                 printErrorAndExit("Invalid bi-directional parameter");
             }
         } else if (arg == "-t" && i + 1 < argc) {
             timeout = std::stoi(argv[++i]);
+        } else if (arg == "--idle-timeout" && i + 1 < argc) {
+            idle_timeout = std::stoi(argv[++i]);
+        } else if (arg == "--read-timeout" && i + 1 < argc) {
+            read_timeout = std::stoi(argv[++i]);
+        } else if (arg == "--connect-retries" && i + 1 < argc) {
+            connect_options.retries = std::stoi(argv[++i]);
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_target = argv[++i];
+        } else if (arg == "--io-uring") {
+            setIoBackend(IO_BACKEND_URING);
+        } else if (arg == "--serve") {
+            serve = true;
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                acceptors = std::stoi(argv[++i]);
+            }
+        } else if (arg == "--threads") {
+            // One event loop per CPU unless a count is given
+            threads = availableCpus();
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                threads = std::stoi(argv[++i]);
+            }
+        } else if (arg == "--max-clients" && i + 1 < argc) {
+            max_clients = std::stoi(argv[++i]);
+        } else if (arg == "--pool" && i + 1 < argc) {
+            pool = std::stoi(argv[++i]);
+        } else if (arg == "--udp-batch" && i + 1 < argc) {
+            datagram_options.batch = std::stoi(argv[++i]);
+        } else if (arg == "--udp-size" && i + 1 < argc) {
+            datagram_options.size = std::stoul(argv[++i]);
+        } else if (arg == "--hugepages") {
+            datagram_options.hugePages = true;
+        } else if (arg == "--coalesce" && i + 1 < argc) {
+            datagram_options.coalesce = std::stoul(argv[++i]);
+        } else if (arg == "--coalesce-delay" && i + 1 < argc) {
+            datagram_options.delayMs = std::stoi(argv[++i]);
+        } else if (arg == "--split-lines") {
+            datagram_options.lines = true;
         } else {
             printErrorAndExit("Invalid parameter");
         }
@@ -193,39 +324,154 @@ int main(int argc, char *argv[]) {
     if (executable.empty()) {
         printErrorAndExit("Executable not specified");
     }
+    // One JSON line per connection, to a file or to unix:<path>
+    if (!trace_target.empty() && !openTrace(trace_target)) {
+        printErrorAndExit("Failed to open trace: " + std::string(strerror(errno)));
+    }
+    Command command = parseCommand(executable);
+    // builtin:<name> runs in mync itself, with no program started
+    bool builtin = executable.compare(0, 8, "builtin:") == 0;
+    SessionFactory builtin_program;
+    if (builtin) {
+        builtin_program = builtinProgram(command);
+    }
+
+    if (serve) {
+        if (!input_tcp) {
+            printErrorAndExit("--serve needs a TCPS input");
+        }
+        if (acceptors < 1 || max_clients < 0 || pool < 0 || threads < 1) {
+            printErrorAndExit("Invalid serve parameter");
+        }
+        if (threads > 1 && (!builtin || acceptors > 1)) {
+            printErrorAndExit("--threads needs a builtin program and a single acceptor");
+        }
+        // Served connections hand the program the -o socket itself, so nothing gathers its output
+        if (datagram_options.coalesce > 0 || datagram_options.lines ||
+            datagram_options.delayMs != DEFAULT_DATAGRAM_OPTIONS.delayMs) {
+            printErrorAndExit("--coalesce, --coalesce-delay and --split-lines cannot be used with --serve");
+        }
+        // A pooled helper starts its program before any client is handed to it
+        if (pool > 0 && !bidirectional && (output_tcp || output_udp)) {
+            printErrorAndExit("--pool cannot be used with a separate -o");
+        }
+        // Each connection gets its own program, output connection and timeout
+        // Looked up once here, so connections forked later find it cached
+        if (output_tcp || output_udp) {
+            prefetchAddresses(output_host, output_port, output_udp ? SOCK_DGRAM : SOCK_STREAM);
+        }
+        ServeOptions options = {acceptors, max_clients, pool, timeout > 0 ? timeout : 0,
+                                idle_timeout > 0 ? idle_timeout : 0, read_timeout > 0 ? read_timeout : 0, threads};
+        if (builtin) {
+            // Every game of an acceptor is played on its one event loop
+            if (!bidirectional) {
+                printErrorAndExit("--serve with a builtin program needs -b");
+            }
+            runBuiltinServer([&]() { return openServerSocket(input_port, false, true); }, true, options,
+                             builtin_program);
+            printErrorAndExit("Failed to serve clients: " + std::string(strerror(errno)));
+        }
+        runServer([&]() { return openServerSocket(input_port, false, true); }, true, options, [&](int client) {
+            redirectInput(client);
+            if (bidirectional) {
+                redirectOutput(client);
+            } else if (output_tcp || output_udp) {
+                handleClientOutput(output_host, output_port, output_fd, output_udp, connect_options);
+                redirectOutput(output_fd);
+            }
+            execProgram(command);
+        });
+        printErrorAndExit("Failed to serve clients: " + std::string(strerror(errno)));
+    }
 
     if (input_tcp || input_udp) {
         handleServerInput(input_port, input_fd, input_udp);
     }
 
-    if (output_tcp || output_udp) {
-        handleClientOutput(output_host, output_port, output_fd, output_udp);
+    if (bidirectional) {
+        output_fd = input_fd;
+    } else if (output_tcp || output_udp) {
+        handleClientOutput(output_host, output_port, output_fd, output_udp, connect_options);
     }
 
-    if (input_tcp || input_udp) {
+    if (builtin) {
+        if (input_udp || output_udp) {
+            printErrorAndExit("builtin programs need stream input and output");
+        }
+        SessionTimeouts timeouts = {static_cast<uint64_t>(idle_timeout > 0 ? idle_timeout : 0) * 1000,
+                                    static_cast<uint64_t>(read_timeout > 0 ? read_timeout : 0) * 1000,
+                                    static_cast<uint64_t>(timeout > 0 ? timeout : 0) * 1000};
+        int in = input_fd >= 0 ? input_fd : STDIN_FILENO;
+        int out = output_fd >= 0 ? output_fd : STDOUT_FILENO;
+        int result = runBuiltin(in, out, builtin_program, timeouts);
+        if (ConnectionTrace *trace = processTrace()) {
+            trace->end();
+        }
+        if (result < 0) {
+            if (errno == ETIMEDOUT) {
+                printErrorAndExit("Timeout reached, exiting.");
+            }
+            printErrorAndExit("Failed to run builtin program: " + std::string(strerror(errno)));
+        }
+        if (input_fd >= 0) close(input_fd);
+        if (output_fd >= 0 && output_fd != input_fd) close(output_fd);
+        return 0;
+    }
+
+    // Datagram sides are served by the batching engine; the program reads and
+    // writes one datagram at a time on a channel, as it would on the socket
+    int child_in = -1, child_out = -1, to_child = -1, from_child = -1;
+    if (input_udp) {
+        createChannel(child_in, to_child);
+    } else if (input_tcp) {
         redirectInput(input_fd);
     }
 
-    if (output_tcp || output_udp) {
+    if ((output_udp || (bidirectional && input_udp)) && datagram_options.coalesce > 0) {
+        // Output is gathered into datagrams, so it is read as a stream
+        createPipe(from_child, child_out);
+    } else if (output_udp || (bidirectional && input_udp)) {
+        createChannel(child_out, from_child);
+    } else if (output_fd >= 0) {
         redirectOutput(output_fd);
     }
 
-    if (timeout > 0) {
-        signal(SIGALRM, handleTimeout);
-        alarm(timeout);
+    // Idle and read timeouts need traffic that passes through mync
+    if ((idle_timeout > 0 || read_timeout > 0) && !input_udp) {
+        printErrorAndExit("--idle-timeout and --read-timeout need --serve or a UDPS input");
     }
+    SessionTimeouts timeouts = {static_cast<uint64_t>(idle_timeout > 0 ? idle_timeout : 0) * 1000,
+                                static_cast<uint64_t>(read_timeout > 0 ? read_timeout : 0) * 1000,
+                                static_cast<uint64_t>(timeout > 0 ? timeout : 0) * 1000};
 
-    int pid = fork();
+    pid_t pid = spawnCommand(command, child_in, child_out);
     if (pid < 0) {
-        printErrorAndExit("Failed to fork process");
-    } else if (pid == 0) {
-        execl("/bin/sh", "sh", "-c", executable.c_str(), nullptr);
-        printErrorAndExit("Failed to execute program");
+        printErrorAndExit("Failed to execute program: " + std::string(strerror(errno)));
     } else {
+        if (child_in >= 0) close(child_in);
+        if (child_out >= 0) close(child_out);
+        if (to_child >= 0 || from_child >= 0) {
+            int engine_in = input_udp ? input_fd : -1;
+            int engine_out = from_child >= 0 ? output_fd : -1;
+            if (runDatagramEngine(engine_in, to_child, from_child, engine_out, pid, datagram_options, timeouts) < 0) {
+                if (errno == ETIMEDOUT) stopOnTimeout(pid);
+                printErrorAndExit("Failed to relay datagrams: " + std::string(strerror(errno)));
+            }
+        }
         int status;
-        wait(&status);
+        if (waitCommand(pid, timeouts.totalMs, status) < 0) {
+            if (errno == ETIMEDOUT) stopOnTimeout(pid);
+            printErrorAndExit("Failed to wait for program: " + std::string(strerror(errno)));
+        }
+        if (ConnectionTrace *trace = processTrace()) {
+            // The program had the sockets, so the kernel did the counting
+            trace->countSockets(input_fd, output_fd);
+            trace->end(status);
+        }
+        if (to_child >= 0) close(to_child);
+        if (from_child >= 0) close(from_child);
         if (input_fd > 0) close(input_fd);
-        if (output_fd > 0) close(output_fd);
+        if (output_fd > 0 && output_fd != input_fd) close(output_fd);
     }
 
     return 0;
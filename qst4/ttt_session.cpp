@@ -0,0 +1,132 @@
+#include "ttt_session.hpp"
+#include "coroutine.hpp"
+#include "protocol.hpp"
+#include "session.hpp"
+
+#include <memory>
+#include <new>
+
+/**
+ * Prints the board the way ttt does.
+ * @param io The connection to print to.
+ * @param board The board to print.
+ */
+void printBoard(SessionIo &io, const Board &board) {
+    formatBoard(board, io.output());
+}
+
+/**
+ * One connection's game: the board the coroutine plays on, and the
+ * strategy it plays by, shared with every other game. The coroutine is a
+ * member function, so its frame goes in the session.
+ */
+class TttSession : public CoroutineSession {
+public:
+    /**
+     * @param moves The compiled strategy, or nullptr to play perfectly.
+     * @param machine Whether to speak the machine protocol.
+     */
+    TttSession(const StrategyTable *moves, bool machine) {
+        if (moves) {
+            session_.start(*moves);
+        } else {
+            session_.startPerfect();
+        }
+        run(machine ? playMachineGame() : playInteractiveGame());
+    }
+
+private:
+    SessionTask playInteractiveGame();
+    SessionTask playMachineGame();
+
+    GameSession session_;
+};
+
+/**
+ * ttt's interactive game, turn for turn as its main loop plays it.
+ */
+SessionTask TttSession::playInteractiveGame() {
+    while (true) {
+        printBoard(io(), session_.board());
+        // Program's turn
+        int programMove = session_.programMove();
+        io().write(static_cast<char>('1' + programMove));
+        io().write('\n');
+        if (session_.state() == GAME_PROGRAM_WON) {
+            printBoard(io(), session_.board());
+            io().write("I win\n");
+            co_return;
+        }
+        if (session_.state() == GAME_DRAW) {
+            printBoard(io(), session_.board());
+            io().write("DRAW\n");
+            co_return;
+        }
+
+        // Player's turn
+        int playerMove = 0;
+        co_await io().readInt(playerMove);
+        if (!session_.playerMove(playerMove - 1)) { // Adjust for 0-based index
+            io().write("Error\n");
+            co_return;
+        }
+        if (session_.state() == GAME_PLAYER_WON) {
+            printBoard(io(), session_.board());
+            io().write("I lost\n");
+            co_return;
+        }
+        if (session_.state() == GAME_DRAW) {
+            io().write("DRAW\n");
+            co_return;
+        }
+    }
+}
+
+/**
+ * ttt's --machine game, as playMachine() plays it.
+ */
+SessionTask TttSession::playMachineGame() {
+    while (true) {
+        // Program's turn
+        int programMove = session_.programMove();
+        io().write(static_cast<char>('1' + programMove));
+        io().write('\n');
+        if (session_.state() != GAME_IN_PROGRESS) {
+            io().write(session_.state() == GAME_PROGRAM_WON ? "W\n" : "D\n");
+            co_return;
+        }
+
+        // Player's turn, answering board requests while we wait
+        std::string_view line;
+        while (true) {
+            if (!co_await io().readLine(line)) {
+                co_return;
+            }
+            if (line == "B" || line == "b") {
+                formatBoardLine(session_.board(), io().output());
+                continue;
+            }
+            if (!session_.playerMove(parseMove(line.data(), line.size()))) {
+                io().write("E\n");
+                co_return;
+            }
+            break;
+        }
+        if (session_.state() != GAME_IN_PROGRESS) {
+            io().write(session_.state() == GAME_PLAYER_WON ? "L\n" : "D\n");
+            co_return;
+        }
+    }
+}
+
+SessionFactory tttSessions(const std::string &strategy, bool machine) {
+    // Compiled once here rather than once per game
+    std::shared_ptr<StrategyTable> moves;
+    if (strategy != "--perfect") {
+        moves = std::make_shared<StrategyTable>();
+        compileStrategy(strategy, *moves);
+    }
+    return SessionFactory{sizeof(TttSession), [moves, machine](void *space) -> BuiltinSession * {
+                              return new (space) TttSession(moves.get(), machine);
+                          }};
+}
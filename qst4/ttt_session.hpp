@@ -0,0 +1,13 @@
+#pragma once
+
+#include "builtin.hpp"
+
+#include <string>
+
+/**
+ * Makes the sessions of builtin:ttt, each a coroutine playing ttt's game on one connection.
+ * @param strategy A strategy ttt accepts, already checked.
+ * @param machine Flag to speak ttt's --machine protocol instead of the interactive one.
+ * @return The factory that makes one session per connection.
+ */
+SessionFactory tttSessions(const std::string &strategy, bool machine);
@@ -1,8 +1,15 @@
+#include "command.hpp"
+#include "datagram.hpp"
+#include "event_loop.hpp"
+#include "server.hpp"
+#include "trace.hpp"
+
 #include <iostream>
 #include <string>
 #include <vector>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
@@ -10,6 +17,7 @@
 #include <csignal>
 #include <netinet/in.h>
 #include <sys/wait.h>
+#include <fcntl.h>
 
 // Constants for socket types
 const int TYPE_TCP = 1;
@@ -27,18 +35,34 @@ void printErrorAndExit(const std::string &message) {
 }
 
 /**
- * Sets up the server side to handle input from a TCP, UDP, or Unix domain socket client.
- * @param type The type of socket (TCP, UDP, Unix domain stream, or Unix domain datagram).
+ * Ends a program whose time is up, traces it, then exits with the timeout error.
+ * @param pid The program's process ID.
+ */
+void stopOnTimeout(pid_t pid) {
+    kill(pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+    if (ConnectionTrace *trace = processTrace()) {
+        trace->end(status);
+    }
+    printErrorAndExit("Timeout reached, exiting.");
+}
+
+/**
+ * Opens a Unix domain socket bound to the given path, listening when it is a stream socket.
+ * @param type The type of socket (Unix domain stream or Unix domain datagram).
  * @param path The path for Unix domain sockets.
- * @param input_fd Reference to the input file descriptor.
+ * @param serving Flag to queue many clients on a stream socket instead of one.
+ * @return The socket file descriptor.
  */
-void handleServerInput(int type, const std::string &path, int &input_fd) {
+int openServerSocket(int type, const std::string &path, bool serving) {
     struct sockaddr_un server_addr_un;
+    int fd = -1;
 
     if (type == TYPE_UDS_STREAM || type == TYPE_UDS_DGRAM) {
         // Setup Unix domain socket server
-        input_fd = socket(AF_UNIX, (type == TYPE_UDS_STREAM) ? SOCK_STREAM : SOCK_DGRAM, 0);
-        if (input_fd < 0) {
+        fd = socket(AF_UNIX, (type == TYPE_UDS_STREAM) ? SOCK_STREAM : SOCK_DGRAM, 0);
+        if (fd < 0) {
             printErrorAndExit("Failed to create Unix domain socket");
         }
 
@@ -48,25 +72,42 @@ void handleServerInput(int type, const std::string &path, int &input_fd) {
 
         unlink(path.c_str());  // Remove existing socket file
 
-        if (bind(input_fd, (struct sockaddr *)&server_addr_un, sizeof(server_addr_un)) < 0) {
+        if (bind(fd, (struct sockaddr *)&server_addr_un, sizeof(server_addr_un)) < 0) {
             printErrorAndExit("Failed to bind Unix domain socket");
         }
 
-        if (type == TYPE_UDS_STREAM && listen(input_fd, 1) < 0) {
+        if (type == TYPE_UDS_STREAM && listen(fd, serving ? SOMAXCONN : 1) < 0) {
             printErrorAndExit("Failed to listen on Unix domain stream socket");
         }
-
-        if (type == TYPE_UDS_STREAM) {
-            int client_fd = accept(input_fd, nullptr, nullptr);
-            if (client_fd < 0) {
-                printErrorAndExit("Failed to accept connection on Unix domain stream socket");
-            }
-            close(input_fd);
-            input_fd = client_fd;
-        }
     } else {
         printErrorAndExit("Invalid socket type");
     }
+    return fd;
+}
+
+/**
+ * Sets up the server side to handle input from a TCP, UDP, or Unix domain socket client.
+ * @param type The type of socket (TCP, UDP, Unix domain stream, or Unix domain datagram).
+ * @param path The path for Unix domain sockets.
+ * @param input_fd Reference to the input file descriptor.
+ */
+void handleServerInput(int type, const std::string &path, int &input_fd) {
+    input_fd = openServerSocket(type, path, false);
+    if (ConnectionTrace *trace = processTrace()) {
+        trace->mark(TRACE_BIND);
+    }
+
+    if (type == TYPE_UDS_STREAM) {
+        int client_fd = accept4(input_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            printErrorAndExit("Failed to accept connection on Unix domain stream socket");
+        }
+        if (ConnectionTrace *trace = processTrace()) {
+            trace->mark(TRACE_ACCEPT);
+        }
+        close(input_fd);
+        input_fd = client_fd;
+    }
 }
 
 /**
@@ -119,12 +160,26 @@ void redirectOutput(int fd) {
 }
 
 /**
- * Signal handler for timeout. Prints an error message and exits.
- * @param sig The signal number.
+ * Creates a pipe whose ends are closed when a program is executed.
+ * @param read_end Reference to the read end.
+ * @param write_end Reference to the write end.
  */
-void handleTimeout(int sig) {
-    (void)sig; // To avoid unused parameter warning
-    printErrorAndExit("Timeout reached, exiting.");
+void createPipe(int &read_end, int &write_end) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        printErrorAndExit("Failed to create pipe: " + std::string(strerror(errno)));
+    }
+    read_end = fds[0];
+    write_end = fds[1];
+}
+
+/**
+ * Replaces the current process with the program, run directly or through the shell.
+ * @param command The parsed command line to execute.
+ */
+void execProgram(const Command &command) {
+    execCommand(command);
+    printErrorAndExit("Failed to execute program");
 }
 
 int main(int argc, char *argv[]) {
@@ -136,12 +191,18 @@ int main(int argc, char *argv[]) {
     if (argc < 3) {
         printErrorAndExit("Invalid number of arguments");
     }
+    // A client or -o peer that goes away must be an EPIPE for the relays to
+    // handle rather than end mync; programs get SIGPIPE back when started
+    signal(SIGPIPE, SIG_IGN);
 
     std::string executable;
     int input_type = -1, output_type = -1;
-    std::string input_path, output_path;
-    int timeout = -1;
+    std::string input_path, output_path, trace_target;
+    int timeout = -1, idle_timeout = -1, read_timeout = -1;
     int input_fd = -1, output_fd = -1;
+    bool serve = false;
+    int acceptors = 1, max_clients = 0, pool = 0;
+    DatagramOptions datagram_options = DEFAULT_DATAGRAM_OPTIONS;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -171,6 +232,29 @@ int main(int argc, char *argv[]) {
             }
         } else if (arg == "-t" && i + 1 < argc) {
             timeout = std::stoi(argv[++i]);
+        } else if (arg == "--idle-timeout" && i + 1 < argc) {
+            idle_timeout = std::stoi(argv[++i]);
+        } else if (arg == "--read-timeout" && i + 1 < argc) {
+            read_timeout = std::stoi(argv[++i]);
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_target = argv[++i];
+        } else if (arg == "--io-uring") {
+            setIoBackend(IO_BACKEND_URING);
+        } else if (arg == "--serve") {
+            serve = true;
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0]))) {
+                acceptors = std::stoi(argv[++i]);
+            }
+        } else if (arg == "--max-clients" && i + 1 < argc) {
+            max_clients = std::stoi(argv[++i]);
+        } else if (arg == "--pool" && i + 1 < argc) {
+            pool = std::stoi(argv[++i]);
+        } else if (arg == "--coalesce" && i + 1 < argc) {
+            datagram_options.coalesce = std::stoul(argv[++i]);
+        } else if (arg == "--coalesce-delay" && i + 1 < argc) {
+            datagram_options.delayMs = std::stoi(argv[++i]);
+        } else if (arg == "--split-lines") {
+            datagram_options.lines = true;
         } else {
             printErrorAndExit("Invalid parameter");
         }
@@ -179,6 +263,41 @@ int main(int argc, char *argv[]) {
     if (executable.empty()) {
         printErrorAndExit("Executable not specified");
     }
+    // One JSON line per connection, to a file or to unix:<path>
+    if (!trace_target.empty() && !openTrace(trace_target)) {
+        printErrorAndExit("Failed to open trace: " + std::string(strerror(errno)));
+    }
+    Command command = parseCommand(executable);
+
+    if (serve) {
+        if (input_type != TYPE_UDS_STREAM) {
+            printErrorAndExit("--serve needs a UDSSS input");
+        }
+        if (acceptors < 1 || max_clients < 0 || pool < 0) {
+            printErrorAndExit("Invalid serve parameter");
+        }
+        // Served connections hand the program the -o socket itself, so nothing gathers its output
+        if (datagram_options.coalesce > 0 || datagram_options.lines ||
+            datagram_options.delayMs != DEFAULT_DATAGRAM_OPTIONS.delayMs) {
+            printErrorAndExit("--coalesce, --coalesce-delay and --split-lines cannot be used with --serve");
+        }
+        // A pooled helper starts its program before any client is handed to it
+        if (pool > 0 && output_type != -1) {
+            printErrorAndExit("--pool cannot be used with a separate -o");
+        }
+        // Unix sockets have no SO_REUSEPORT, so the acceptors share one listener
+        ServeOptions options = {acceptors, max_clients, pool, timeout > 0 ? timeout : 0,
+                                idle_timeout > 0 ? idle_timeout : 0, read_timeout > 0 ? read_timeout : 0, 1};
+        runServer([&]() { return openServerSocket(input_type, input_path, true); }, false, options, [&](int client) {
+            redirectInput(client);
+            if (output_type != -1) {
+                handleClientOutput(output_type, output_path, output_fd);
+                redirectOutput(output_fd);
+            }
+            execProgram(command);
+        });
+        printErrorAndExit("Failed to serve clients: " + std::string(strerror(errno)));
+    }
 
     if (input_type != -1) {
         handleServerInput(input_type, input_path, input_fd);
@@ -188,20 +307,44 @@ int main(int argc, char *argv[]) {
         handleClientOutput(output_type, output_path, output_fd);
     }
 
-    if (timeout > 0) {
-        signal(SIGALRM, handleTimeout);
-        alarm(timeout);
+    if (input_type != -1) {
+        redirectInput(input_fd);
+    }
+
+    // Coalesced datagram output is gathered from a pipe by the datagram engine
+    int child_out = -1, from_child = -1;
+    if (output_type == TYPE_UDS_DGRAM && datagram_options.coalesce > 0) {
+        createPipe(from_child, child_out);
+    } else if (output_type != -1) {
+        redirectOutput(output_fd);
     }
 
-    int pid = fork();
+    // Idle and read timeouts need traffic that passes through mync
+    if (idle_timeout > 0 || read_timeout > 0) {
+        printErrorAndExit("--idle-timeout and --read-timeout need --serve");
+    }
+    SessionTimeouts timeouts = {0, 0, static_cast<uint64_t>(timeout > 0 ? timeout : 0) * 1000};
+
+    pid_t pid = spawnCommand(command, -1, child_out);
     if (pid < 0) {
-        printErrorAndExit("Failed to fork process");
-    } else if (pid == 0) {
-        execl("/bin/sh", "sh", "-c", executable.c_str(), nullptr);
-        printErrorAndExit("Failed to execute program");
+        printErrorAndExit("Failed to execute program: " + std::string(strerror(errno)));
     } else {
+        if (child_out >= 0) {
+            close(child_out);
+            if (runDatagramEngine(-1, -1, from_child, output_fd, pid, datagram_options, timeouts) < 0) {
+                if (errno == ETIMEDOUT) stopOnTimeout(pid);
+                printErrorAndExit("Failed to send datagrams: " + std::string(strerror(errno)));
+            }
+            close(from_child);
+        }
         int status;
-        wait(&status);
+        if (waitCommand(pid, timeouts.totalMs, status) < 0) {
+            if (errno == ETIMEDOUT) stopOnTimeout(pid);
+            printErrorAndExit("Failed to wait for program: " + std::string(strerror(errno)));
+        }
+        if (ConnectionTrace *trace = processTrace()) {
+            trace->end(status);
+        }
         if (input_fd > 0) close(input_fd);
         if (output_fd > 0) close(output_fd);
     }